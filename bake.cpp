@@ -0,0 +1,321 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "util.h"
+#include "bvh.h"
+#include "thread_pool.h"
+#include "bake.h"
+
+using namespace std;
+
+/*
+ * Static lighting baker: the sun and the terrain never change, so the light
+ * loop in frag.glsl can be evaluated once per vertex (with shadows and
+ * ray-traced ambient occlusion, which the shader can't afford) and stored
+ * as a vertex attribute.
+ */
+
+/* same material colour as frag.glsl */
+static const glm::vec3 bake_material_diffuse = glm::vec3(1.0, 0.8, 0.8);
+
+/* per-job state shared by the worker threads */
+struct bake_job {
+    struct bake_mesh *meshes;
+    GLuint num_meshes;
+    const struct LightSource *lights;
+    GLuint num_lights;
+    const struct bake_settings *settings;
+
+    struct bvh scene;
+    std::vector<glm::vec3> positions;    /* world space, all meshes back to back */
+    std::vector<glm::vec3> normals;
+    std::vector<GLuint> first_vertex;    /* per mesh offset into the above */
+};
+
+/* hash of everything the bake depends on; a cached bake is only used if
+ * this matches */
+GLuint64 bake_hash(const struct bake_mesh *meshes,
+                   GLuint num_meshes,
+                   const struct LightSource *lights,
+                   GLuint num_lights,
+                   const struct bake_settings *settings) {
+    GLuint64 hash = HASH_SEED;
+    GLuint i;
+
+    for (i = 0; i < num_meshes; i++) {
+        const struct mesh_data *mesh = meshes[i].mesh;
+        if (!mesh->vertices.empty())
+            hash = hash_bytes(&mesh->vertices[0], sizeof(glm::vec3) * mesh->vertices.size(), hash);
+        if (!mesh->elements.empty())
+            hash = hash_bytes(&mesh->elements[0], sizeof(GLushort) * mesh->elements.size(), hash);
+        hash = hash_bytes(&meshes[i].model_matrix, sizeof(glm::mat4), hash);
+    }
+
+    hash = hash_bytes(lights, sizeof(struct LightSource) * num_lights, hash);
+    hash = hash_bytes(&settings->ao_samples, sizeof(settings->ao_samples), hash);
+    hash = hash_bytes(&settings->ao_distance, sizeof(settings->ao_distance), hash);
+    hash = hash_bytes(&settings->shadows, sizeof(settings->shadows), hash);
+
+    return hash;
+}
+
+/* xorshift, seeded per vertex so the result doesn't depend on thread timing */
+static inline GLfloat bake_random(GLuint *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state / 4294967296.0f;
+}
+
+/* direct lighting at a point: the light loop of frag.glsl, plus shadow rays */
+static glm::vec3 bake_direct(const struct bake_job *job,
+                             glm::vec3 position,
+                             glm::vec3 normal) {
+    glm::vec3 total = glm::vec3(0.0);
+    glm::vec3 origin = position + normal * (GLfloat)BAKE_RAY_BIAS;
+
+    GLuint i;
+    for (i = 0; i < job->num_lights; i++) {
+        const struct LightSource *light = &job->lights[i];
+        glm::vec3 light_direction;
+        GLfloat attenuation;
+        GLfloat light_distance;
+
+        if (light->position.w == 0.0) {   /* directional */
+            attenuation = 1.0;
+            light_direction = glm::normalize(glm::vec3(light->position));
+            light_distance = 1e30f;
+        }
+        else {                              /* point */
+            glm::vec3 to_light = glm::vec3(light->position) - position;
+            light_distance = glm::length(to_light);
+            attenuation = 1.0f / (light->attenuation.x * light_distance * light_distance
+                                  + light->attenuation.y * light_distance
+                                  + light->attenuation.z);
+            light_direction = to_light / light_distance;
+        }
+
+        GLfloat lambert = glm::dot(normal, light_direction);
+        if (lambert <= 0.0f)
+            continue;
+
+        if (job->settings->shadows
+            && bvh_occluded(&job->scene, origin, light_direction, light_distance))
+            continue;
+
+        total += attenuation * light->diffuse * bake_material_diffuse * lambert;
+    }
+
+    return total;
+}
+
+/* fraction of cosine-weighted hemisphere rays that escape within ao_distance */
+static GLfloat bake_occlusion(const struct bake_job *job,
+                              glm::vec3 position,
+                              glm::vec3 normal,
+                              GLuint seed) {
+    GLuint samples = job->settings->ao_samples;
+    if (samples == 0)
+        return 1.0f;
+
+    /* tangent frame around the normal */
+    glm::vec3 helper = (fabsf(normal.x) > 0.9f) ? glm::vec3(0.0, 1.0, 0.0) : glm::vec3(1.0, 0.0, 0.0);
+    glm::vec3 tangent = glm::normalize(glm::cross(helper, normal));
+    glm::vec3 bitangent = glm::cross(normal, tangent);
+
+    glm::vec3 origin = position + normal * (GLfloat)BAKE_RAY_BIAS;
+    GLuint state = seed * 2654435761u + 1;
+    GLuint open = 0;
+
+    GLuint i;
+    for (i = 0; i < samples; i++) {
+        GLfloat r = sqrtf(bake_random(&state));
+        GLfloat phi = 6.2831853f * bake_random(&state);
+        GLfloat x = r * cosf(phi);
+        GLfloat y = r * sinf(phi);
+        GLfloat z = sqrtf(fmaxf(0.0f, 1.0f - x * x - y * y));
+
+        glm::vec3 direction = tangent * x + bitangent * y + normal * z;
+        if (!bvh_occluded(&job->scene, origin, direction, job->settings->ao_distance))
+            open += 1;
+    }
+
+    return (GLfloat)open / samples;
+}
+
+/* thread pool task: bake vertices [begin, end) of the flattened vertex list */
+static void bake_vertices(void *context, GLuint begin, GLuint end) {
+    struct bake_job *job = (struct bake_job *)context;
+
+    GLuint mesh_idx = 0;
+    GLuint v;
+    for (v = begin; v < end; v++) {
+        while (mesh_idx + 1 < job->num_meshes && v >= job->first_vertex[mesh_idx + 1])
+            mesh_idx += 1;
+
+        glm::vec3 position = job->positions[v];
+        glm::vec3 normal = job->normals[v];
+
+        glm::vec3 direct = bake_direct(job, position, normal);
+        GLfloat occlusion = bake_occlusion(job, position, normal, v);
+
+        job->meshes[mesh_idx].baked[v - job->first_vertex[mesh_idx]] = glm::vec4(direct, occlusion);
+    }
+}
+
+/* bake every mesh's vertices, spread over the thread pool */
+void bake_static_lighting(struct bake_mesh *meshes,
+                          GLuint num_meshes,
+                          const struct LightSource *lights,
+                          GLuint num_lights,
+                          const struct bake_settings *settings,
+                          struct thread_pool *pool) {
+    struct bake_job job;
+    job.meshes = meshes;
+    job.num_meshes = num_meshes;
+    job.lights = lights;
+    job.num_lights = num_lights;
+    job.settings = settings;
+
+    /* move everything into world space, and index all triangles together */
+    vector<glm::vec3> corners;
+    GLuint i, j;
+    for (i = 0; i < num_meshes; i++) {
+        const struct mesh_data *mesh = meshes[i].mesh;
+        glm::mat4 model = meshes[i].model_matrix;
+        glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model)));
+
+        job.first_vertex.push_back((GLuint)job.positions.size());
+        for (j = 0; j < mesh->vertices.size(); j++) {
+            job.positions.push_back(glm::vec3(model * glm::vec4(mesh->vertices[j], 1.0)));
+            job.normals.push_back(glm::normalize(normal_matrix * mesh->normals[j]));
+        }
+
+        for (j = 0; j + 2 < mesh->elements.size(); j += 3) {
+            corners.push_back(job.positions[job.first_vertex[i] + mesh->elements[j]]);
+            corners.push_back(job.positions[job.first_vertex[i] + mesh->elements[j+1]]);
+            corners.push_back(job.positions[job.first_vertex[i] + mesh->elements[j+2]]);
+        }
+
+        meshes[i].baked.assign(mesh->vertices.size(), glm::vec4(0.0, 0.0, 0.0, 1.0));
+    }
+
+    bvh_build_triangles(&job.scene, corners);
+
+    thread_pool_run(pool, (GLuint)job.positions.size(), 64, bake_vertices, &job);
+}
+
+/* read a cached bake; GL_FALSE if missing or baked from different inputs */
+GLboolean bake_cache_load(const char *path,
+                          GLuint64 hash,
+                          vector<glm::vec4> &baked) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return GL_FALSE;
+
+    GLuint magic = 0;
+    GLuint64 file_hash = 0;
+    GLuint count = 0;
+    GLboolean ok = fread(&magic, sizeof(magic), 1, f) == 1
+                && fread(&file_hash, sizeof(file_hash), 1, f) == 1
+                && fread(&count, sizeof(count), 1, f) == 1
+                && magic == BAKE_CACHE_MAGIC
+                && file_hash == hash;
+
+    if (ok) {
+        baked.resize(count);
+        ok = count == 0 || fread(&baked[0], sizeof(glm::vec4), count, f) == count;
+    }
+
+    fclose(f);
+    return ok;
+}
+
+void bake_cache_save(const char *path,
+                     GLuint64 hash,
+                     const vector<glm::vec4> &baked) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for writing\n", path);
+        return;
+    }
+
+    GLuint magic = BAKE_CACHE_MAGIC;
+    GLuint count = (GLuint)baked.size();
+    fwrite(&magic, sizeof(magic), 1, f);
+    fwrite(&hash, sizeof(hash), 1, f);
+    fwrite(&count, sizeof(count), 1, f);
+    if (count > 0)
+        fwrite(&baked[0], sizeof(glm::vec4), count, f);
+    fclose(f);
+}
+
+/* the bake thread: everything bake_scene used to do but the upload */
+static void bake_task_run(struct bake_task *task) {
+    GLuint num_meshes = (GLuint)task->meshes.size();
+    GLuint i;
+
+    task->baked.assign(num_meshes, bake_mesh());
+    for (i = 0; i < num_meshes; i++) {
+        task->baked[i].mesh = task->meshes[i];
+        task->baked[i].model_matrix = task->model_matrices[i];
+    }
+
+    const struct LightSource *lights = task->lights.empty() ? NULL : &task->lights[0];
+    GLuint num_lights = (GLuint)task->lights.size();
+    GLuint64 hash = bake_hash(&task->baked[0], num_meshes, lights, num_lights, &task->settings);
+
+    GLboolean cached = GL_TRUE;
+    for (i = 0; i < num_meshes && cached; i++)
+        cached = bake_cache_load((task->paths[i] + ".bake").c_str(), hash, task->baked[i].baked);
+
+    task->bake_ms = 0.0;
+    if (!cached) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bake_static_lighting(&task->baked[0], num_meshes, lights, num_lights, &task->settings, task->pool);
+        task->bake_ms = chrono::duration<GLdouble, milli>(chrono::steady_clock::now() - start).count();
+
+        for (i = 0; i < num_meshes; i++)
+            bake_cache_save((task->paths[i] + ".bake").c_str(), hash, task->baked[i].baked);
+    }
+
+    task->done = GL_TRUE;
+}
+
+/* start baking in the background; the task must not be running */
+void bake_task_start(struct bake_task *task) {
+    task->done = GL_FALSE;
+    task->running = GL_TRUE;
+    task->thread = thread(bake_task_run, task);
+}
+
+/* GL_TRUE once, when a running bake has finished (its outputs are then
+ * the caller's); never blocks */
+GLboolean bake_task_finished(struct bake_task *task) {
+    if (!task->running || !task->done)
+        return GL_FALSE;
+
+    if (task->thread.joinable())
+        task->thread.join();
+    task->running = GL_FALSE;
+    return GL_TRUE;
+}
+
+/* block until a running bake has finished (bake_task_finished then
+ * reports it) */
+void bake_task_wait(struct bake_task *task) {
+    if (task->running && task->thread.joinable())
+        task->thread.join();
+}
@@ -0,0 +1,69 @@
+#define BAKE_AO_SAMPLES 64
+#define BAKE_AO_DISTANCE 1.5        /* occluders further away than this don't count */
+#define BAKE_RAY_BIAS 0.001         /* offset along the normal to avoid self-hits */
+#define BAKE_CACHE_MAGIC 0x4B41424Du   /* "MBAK" */
+
+/* structure definitions */
+
+/* one static mesh, placed in the world, to bake lighting for. All meshes
+ * baked together occlude each other */
+struct bake_mesh {
+    const struct mesh_data *mesh;
+    glm::mat4 model_matrix;
+
+    /* output, one per vertex: rgb = direct diffuse light (as in frag.glsl,
+     * shadowed), a = ambient occlusion (1 = fully open) */
+    std::vector<glm::vec4> baked;
+};
+
+struct bake_settings {
+    GLuint ao_samples;
+    GLfloat ao_distance;
+    GLboolean shadows;
+};
+
+/* a bake run in the background: a thread of its own takes each mesh from
+ * its cache or bakes it (on the pool) and saves the caches, so the render
+ * thread only starts it and picks up the result when it's done */
+struct bake_task {
+    /* inputs, set before bake_task_start */
+    std::vector<const struct mesh_data *> meshes;   /* the caller's; not to change until it's done */
+    std::vector<std::string> paths;         /* .obj per mesh; cached in <path>.bake */
+    std::vector<glm::mat4> model_matrices;
+    std::vector<struct LightSource> lights;
+    struct bake_settings settings;
+    struct thread_pool *pool;               /* not to be used by anyone else meanwhile */
+
+    /* outputs, once bake_task_finished */
+    std::vector<struct bake_mesh> baked;    /* parallel to meshes */
+    GLdouble bake_ms;                       /* 0 if every mesh came from its cache */
+
+    std::thread thread;
+    std::atomic<GLboolean> done;
+    GLboolean running;
+};
+
+/* function prototypes */
+GLuint64 bake_hash(const struct bake_mesh *meshes,
+                   GLuint num_meshes,
+                   const struct LightSource *lights,
+                   GLuint num_lights,
+                   const struct bake_settings *settings);
+
+void bake_static_lighting(struct bake_mesh *meshes,
+                          GLuint num_meshes,
+                          const struct LightSource *lights,
+                          GLuint num_lights,
+                          const struct bake_settings *settings,
+                          struct thread_pool *pool);
+
+GLboolean bake_cache_load(const char *path,
+                          GLuint64 hash,
+                          std::vector<glm::vec4> &baked);
+void bake_cache_save(const char *path,
+                     GLuint64 hash,
+                     const std::vector<glm::vec4> &baked);
+
+void bake_task_start(struct bake_task *task);
+GLboolean bake_task_finished(struct bake_task *task);
+void bake_task_wait(struct bake_task *task);
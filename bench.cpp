@@ -0,0 +1,992 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <GL/glew.h>
+
+#include <math.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "util.h"
+#include "camera.h"
+#include "bvh.h"
+#include "scene_store.h"
+#include "thread_pool.h"
+#include "mesh_arena.h"
+#include "bake.h"
+#include "softrast.h"
+#include "resolution.h"
+#include "heightmap.h"
+#include "tile_stream.h"
+
+/*
+ * CPU benchmarks for the engine's non-GL code paths; no window or context
+ * is created, so this runs on headless machines.
+ *
+ * Results are one JSON document on stdout (or -o file): a flat list of
+ * {"name", "value", "unit"} whose names and order don't change between
+ * runs, so runs from different commits can be diffed. Anything else the
+ * code under test prints goes to stderr. Arguments other than -o pick
+ * benchmark groups by name (e.g. "mars_bench load_obj normals"). Assets
+ * (terrain_tex.obj, base.obj) are read from the working directory; the
+ * scratch files some groups write (a few hundred MB at most) go to -t dir,
+ * $TMPDIR or /tmp.
+ */
+
+#define BENCH_JSON_VERSION 1
+
+#define BENCH_HEIGHT_QUERIES 4000000
+#define BENCH_RAY_QUERIES 1000000
+#define BENCH_SCENE_ENTITIES 100000
+#define BENCH_SCENE_CHILDREN 9     /* per root entity */
+#define BENCH_SOFTRAST_FRAMES 20
+#define BENCH_ARENA_MESHES 4096   /* live at once */
+#define BENCH_ARENA_OPS 1000000
+#define BENCH_RESOLUTION_FRAMES 600
+#define BENCH_HEIGHTMAP_QUERIES 1000000
+#define BENCH_TILES_SIDE 2049       /* samples per side of the streamed terrain */
+#define BENCH_TILES_FRAMES 900
+#define BENCH_TILES_SPEED 0.25      /* camera travel per frame, world units */
+#define BENCH_TILES_FRAME_MS 2      /* real time per simulated frame */
+#define BENCH_TILES_LATENCY_MS 2    /* simulated storage latency per tile */
+#define BENCH_FILE_BYTES (512 << 20)    /* read per file_contents size */
+#define BENCH_OBJ_EXTENT 10.0f
+#define BENCH_NORMAL_TRIANGLES 16000000 /* generated per mesh size */
+#define BENCH_TOUR_FRAMES 10000000
+#define BENCH_TOUR_LOOKAHEADS 1000000
+#define BENCH_MODEL_PROGRAMS 8
+#define BENCH_MODEL_TEXTURES 16
+#define BENCH_MODEL_REPEATS 20
+
+static FILE *bench_out;
+static GLuint bench_results;
+static string bench_scratch_dir;
+
+/* one measurement, named "<group>/<case>/<metric>" */
+static void bench_result(const char *unit,
+                         double value,
+                         const char *name_format,
+                         ...) {
+    char name[128];
+    va_list args;
+    va_start(args, name_format);
+    vsnprintf(name, sizeof(name), name_format, args);
+    va_end(args);
+
+    fprintf(bench_out, "%s\n    {\"name\": \"%s\", ", bench_results ? "," : "", name);
+    if (isfinite(value))
+        fprintf(bench_out, "\"value\": %.9g, ", value);
+    else
+        fprintf(bench_out, "\"value\": null, ");
+    fprintf(bench_out, "\"unit\": \"%s\"}", unit);
+    bench_results += 1;
+}
+
+/* path of a scratch file, in the scratch directory */
+static string bench_scratch(const char *name) {
+    return bench_scratch_dir + "/" + name;
+}
+
+static double now_seconds() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* xorshift: cheap, deterministic across platforms */
+static GLuint bench_random_state = 2463534242u;
+static GLfloat bench_random(GLfloat lo, GLfloat hi) {
+    bench_random_state ^= bench_random_state << 13;
+    bench_random_state ^= bench_random_state >> 17;
+    bench_random_state ^= bench_random_state << 5;
+    return lo + (hi - lo) * (bench_random_state / 4294967296.0f);
+}
+
+/* rolling heightfield of size x size quads spanning [-extent, extent] */
+static void make_heightfield(GLuint size,
+                             GLfloat extent,
+                             vector<glm::vec3> &vertices,
+                             vector<GLushort> &elements) {
+    GLuint x, z;
+    for (z = 0; z <= size; z++) {
+        for (x = 0; x <= size; x++) {
+            GLfloat px = -extent + 2.0f * extent * x / size;
+            GLfloat pz = -extent + 2.0f * extent * z / size;
+            vertices.push_back(glm::vec3(px, 0.5f * sinf(px * 1.3f) * cosf(pz * 0.7f), pz));
+        }
+    }
+
+    for (z = 0; z < size; z++) {
+        for (x = 0; x < size; x++) {
+            GLushort i = (GLushort)(z * (size + 1) + x);
+            elements.push_back(i);
+            elements.push_back(i + 1);
+            elements.push_back(i + size + 1);
+            elements.push_back(i + 1);
+            elements.push_back(i + size + 2);
+            elements.push_back(i + size + 1);
+        }
+    }
+}
+
+/* build + height + ray queries against one mesh; all null without one */
+static void bench_bvh(const char *name,
+                      const vector<glm::vec3> &vertices,
+                      const vector<GLushort> &elements) {
+    if (elements.size() < 3) {
+        bench_result("count", NAN, "bvh/%s/triangles", name);
+        bench_result("ms", NAN, "bvh/%s/build", name);
+        bench_result("ns", NAN, "bvh/%s/height_query", name);
+        bench_result("ns", NAN, "bvh/%s/ray_query", name);
+        bench_result("count", NAN, "bvh/%s/ray_hits", name);
+        return;
+    }
+
+    struct bvh tree;
+
+    double start = now_seconds();
+    bvh_build(&tree, vertices, elements);
+    double build_time = now_seconds() - start;
+
+    glm::vec3 lo = tree.nodes[0].bounds_min;
+    glm::vec3 hi = tree.nodes[0].bounds_max;
+
+    vector<glm::vec2> points(BENCH_HEIGHT_QUERIES);
+    vector<GLfloat> heights(BENCH_HEIGHT_QUERIES);
+    GLuint i;
+    for (i = 0; i < BENCH_HEIGHT_QUERIES; i++)
+        points[i] = glm::vec2(bench_random(lo.x, hi.x), bench_random(lo.z, hi.z));
+
+    start = now_seconds();
+    bvh_heights_at(&tree, &points[0], &heights[0], BENCH_HEIGHT_QUERIES, 0.0f);
+    double height_time = now_seconds() - start;
+
+    GLuint hits = 0;
+    start = now_seconds();
+    for (i = 0; i < BENCH_RAY_QUERIES; i++) {
+        glm::vec3 origin = glm::vec3(bench_random(lo.x, hi.x), hi.y + 1.0f, bench_random(lo.z, hi.z));
+        glm::vec3 direction = glm::normalize(glm::vec3(bench_random(-1.0f, 1.0f), -1.0f, bench_random(-1.0f, 1.0f)));
+        struct bvh_hit hit;
+        hits += bvh_intersect_ray(&tree, origin, direction, 1000.0f, &hit);
+    }
+    double ray_time = now_seconds() - start;
+
+    bench_result("count", elements.size() / 3, "bvh/%s/triangles", name);
+    bench_result("ms", build_time * 1e3, "bvh/%s/build", name);
+    bench_result("ns", height_time * 1e9 / BENCH_HEIGHT_QUERIES, "bvh/%s/height_query", name);
+    bench_result("ns", ray_time * 1e9 / BENCH_RAY_QUERIES, "bvh/%s/ray_query", name);
+    bench_result("count", hits, "bvh/%s/ray_hits", name);
+}
+
+static void bench_terrain_index() {
+    struct mesh_data terrain;
+    load_mesh("terrain_tex.obj", &terrain, GL_TRUE);   /* empty if missing */
+    bench_bvh("terrain_tex.obj", terrain.vertices, terrain.elements);
+
+    GLuint sizes[] = { 16, 64, 255 };
+    GLuint i;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        vector<glm::vec3> vertices;
+        vector<GLushort> elements;
+        char name[32];
+
+        make_heightfield(sizes[i], 10.0f, vertices, elements);
+        snprintf(name, sizeof(name), "grid_%ux%u", sizes[i], sizes[i]);
+        bench_bvh(name, vertices, elements);
+    }
+}
+
+/* transform update for a 100k entity scene: everything moved, then 1% moved */
+static void bench_scene_store() {
+    struct scene_store store = scene_store();
+    scene_store_reserve(&store, BENCH_SCENE_ENTITIES);
+
+    GLuint root = SCENE_NO_PARENT;
+    GLuint i;
+    for (i = 0; i < BENCH_SCENE_ENTITIES; i++) {
+        GLuint entity = scene_store_create(&store, (i % (BENCH_SCENE_CHILDREN + 1)) ? root : SCENE_NO_PARENT);
+        if (store.parents[entity] == SCENE_NO_PARENT)
+            root = entity;
+
+        scene_store_set_position(&store, entity, glm::vec3(bench_random(-10.0f, 10.0f),
+                                                           bench_random(-1.0f, 1.0f),
+                                                           bench_random(-10.0f, 10.0f)));
+        scene_store_set_rotation(&store, entity, glm::vec3(0.0, bench_random(0.0f, 6.28f), 0.0));
+    }
+
+    double start = now_seconds();
+    GLuint updated_all = scene_store_update(&store);
+    double all_time = now_seconds() - start;
+
+    for (i = 0; i < BENCH_SCENE_ENTITIES; i += 100)
+        scene_store_set_position(&store, i, store.positions[i] + glm::vec3(0.0, 0.01, 0.0));
+
+    start = now_seconds();
+    GLuint updated_some = scene_store_update(&store);
+    double some_time = now_seconds() - start;
+
+    start = now_seconds();
+    scene_store_update(&store);
+    double none_time = now_seconds() - start;
+
+    bench_result("count", store.count, "scene_store/%u/entities", BENCH_SCENE_ENTITIES);
+    bench_result("ms", all_time * 1e3, "scene_store/%u/all_dirty", BENCH_SCENE_ENTITIES);
+    bench_result("count", updated_all, "scene_store/%u/all_dirty_updated", BENCH_SCENE_ENTITIES);
+    bench_result("ms", some_time * 1e3, "scene_store/%u/1pct_dirty", BENCH_SCENE_ENTITIES);
+    bench_result("count", updated_some, "scene_store/%u/1pct_dirty_updated", BENCH_SCENE_ENTITIES);
+    bench_result("ms", none_time * 1e3, "scene_store/%u/clean", BENCH_SCENE_ENTITIES);
+}
+
+/* static lighting bake of the terrain + base scene, single vs all threads;
+ * all null without the meshes */
+static void bench_bake() {
+    struct mesh_data terrain_mesh;
+    struct mesh_data base_mesh;
+    GLboolean loaded = load_mesh("terrain_tex.obj", &terrain_mesh, GL_TRUE);
+    loaded = load_mesh("base.obj", &base_mesh, GL_FALSE) && loaded;
+
+    struct bake_mesh meshes[2];
+    meshes[0].mesh = &terrain_mesh;
+    meshes[0].model_matrix = glm::mat4(1.0);
+    meshes[1].mesh = &base_mesh;
+    meshes[1].model_matrix = glm::mat4(1.0);
+
+    struct LightSource sun;
+    sun.position = glm::vec4(-0.451442, 3.999998, -3.918742, 0.0);
+    sun.diffuse = glm::vec3(1.0, 0.5, 0.5);
+    sun.attenuation = glm::vec3(20.0, 5.0, 0.0);
+
+    struct bake_settings settings;
+    settings.ao_samples = BAKE_AO_SAMPLES;
+    settings.ao_distance = BAKE_AO_DISTANCE;
+    settings.shadows = GL_TRUE;
+
+    GLuint thread_counts[] = { 1, 0 };
+    GLuint i;
+    for (i = 0; i < 2; i++) {
+        const char *threads = thread_counts[i] ? "single" : "all";
+        if (!loaded) {
+            bench_result("count", NAN, "bake/%s/vertices", threads);
+            bench_result("count", NAN, "bake/%s/threads", threads);
+            bench_result("ms", NAN, "bake/%s/bake", threads);
+            bench_result("fraction", NAN, "bake/%s/mean_terrain_ao", threads);
+            continue;
+        }
+
+        struct thread_pool pool;
+        thread_pool_start(&pool, thread_counts[i] ? thread_counts[i] - 1 : 0);
+
+        double start = now_seconds();
+        bake_static_lighting(meshes, 2, &sun, 1, &settings, &pool);
+        double bake_time = now_seconds() - start;
+
+        GLfloat mean_occlusion = 0.0;
+        GLuint v;
+        for (v = 0; v < meshes[0].baked.size(); v++)
+            mean_occlusion += meshes[0].baked[v].w / meshes[0].baked.size();
+
+        bench_result("count", terrain_mesh.vertices.size() + base_mesh.vertices.size(), "bake/%s/vertices", threads);
+        bench_result("count", pool.workers.size() + 1, "bake/%s/threads", threads);
+        bench_result("ms", bake_time * 1e3, "bake/%s/bake", threads);
+        bench_result("fraction", mean_occlusion, "bake/%s/mean_terrain_ao", threads);
+
+        thread_pool_stop(&pool);
+    }
+}
+
+/* software rasterizer: 800x600 frames of heightfields looked at from above
+ * the edge, so most of the screen is covered at varying depth */
+static void bench_softrast() {
+    GLuint sizes[] = { 64, 255 };
+    GLuint thread_counts[] = { 1, 0 };
+
+    struct softrast_target target;
+    softrast_target_resize(&target, 800, 600);
+
+    struct LightSource sun;
+    sun.position = glm::vec4(-0.451442, 3.999998, -3.918742, 0.0);
+    sun.diffuse = glm::vec3(1.0, 0.5, 0.5);
+    sun.attenuation = glm::vec3(20.0, 5.0, 0.0);
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0, 2.0, -9.0), glm::vec3(0.0), glm::vec3(0.0, 1.0, 0.0));
+    glm::mat4 projection = glm::perspective(45.0f, 800.0f / 600.0f, 0.1f, 20.0f);
+
+    GLuint s, t;
+    for (s = 0; s < 2; s++) {
+        struct mesh_data mesh;
+        make_heightfield(sizes[s], 8.0, mesh.vertices, mesh.elements);
+        mesh.normals.assign(mesh.vertices.size(), glm::vec3(0.0, 1.0, 0.0));
+
+        struct softrast_model model;
+        model.mesh = &mesh;
+        model.texture = NULL;
+        model.model_matrix = glm::mat4(1.0);
+        model.normal_matrix = glm::mat3(1.0);
+        model.ambient = glm::vec3(0.15);
+
+        for (t = 0; t < 2; t++) {
+            struct thread_pool pool;
+            thread_pool_start(&pool, thread_counts[t] ? thread_counts[t] - 1 : 0);
+
+            struct softrast_context context;
+            context.pool = &pool;
+            context.target = &target;
+
+            double start = now_seconds();
+            GLuint frame;
+            for (frame = 0; frame < BENCH_SOFTRAST_FRAMES; frame++) {
+                softrast_clear(&target, glm::vec4(0.1f, 0.1f, 0.15f, 1.0f));
+                softrast_draw(&context, &model, 1, view, projection, &sun, 1);
+            }
+            double frame_time = (now_seconds() - start) / BENCH_SOFTRAST_FRAMES;
+
+            const char *threads = thread_counts[t] ? "single" : "all";
+            bench_result("count", mesh.elements.size() / 3, "softrast/grid_%ux%u/%s/triangles", sizes[s], sizes[s], threads);
+            bench_result("count", pool.workers.size() + 1, "softrast/grid_%ux%u/%s/threads", sizes[s], sizes[s], threads);
+            bench_result("ms", frame_time * 1e3, "softrast/grid_%ux%u/%s/frame", sizes[s], sizes[s], threads);
+
+            thread_pool_stop(&pool);
+        }
+    }
+}
+
+/* mesh arena allocator under churn: meshes of random size are replaced
+ * (as hot reload / streaming would), growing the range when full */
+static void bench_arena() {
+    struct arena_allocator allocator;
+    arena_allocator_init(&allocator, ARENA_INITIAL_VERTICES);
+
+    vector<GLuint> offsets(BENCH_ARENA_MESHES), sizes(BENCH_ARENA_MESHES);
+    GLuint grows = 0;
+    GLuint i;
+
+    double start = now_seconds();
+    for (i = 0; i < BENCH_ARENA_OPS; i++) {
+        GLuint slot = i % BENCH_ARENA_MESHES;
+        if (i >= BENCH_ARENA_MESHES)
+            arena_free(&allocator, offsets[slot], sizes[slot]);
+
+        sizes[slot] = 16 + (GLuint)bench_random(0.0, 2048.0);
+        while (!arena_allocate(&allocator, sizes[slot], &offsets[slot])) {
+            arena_grow(&allocator, allocator.capacity * 2);
+            grows += 1;
+        }
+    }
+    double churn_time = now_seconds() - start;
+
+    struct arena_stats stats;
+    arena_allocator_stats(&allocator, &stats);
+    bench_result("ns", churn_time * 1e9 / BENCH_ARENA_OPS, "arena/%u_live/alloc_free", BENCH_ARENA_MESHES);
+    bench_result("fraction", stats.occupancy, "arena/%u_live/occupancy", BENCH_ARENA_MESHES);
+    bench_result("count", stats.free_blocks, "arena/%u_live/free_blocks", BENCH_ARENA_MESHES);
+    bench_result("fraction", stats.fragmentation, "arena/%u_live/fragmentation", BENCH_ARENA_MESHES);
+    bench_result("count", grows, "arena/%u_live/grows", BENCH_ARENA_MESHES);
+}
+
+/* dynamic resolution controller against a simulated GPU whose frame time
+ * is fixed cost + per-pixel cost (+ noise), with results arriving
+ * RESOLUTION_QUERY_RING frames late as they do from timer queries */
+static void bench_resolution() {
+    GLdouble full_frame_ms[] = { 10.0, 20.0, 40.0 };   /* at 800x600 */
+    GLuint g;
+    for (g = 0; g < 3; g++) {
+        struct resolution_scaler scaler = resolution_scaler();
+        scaler.window_width = 800;
+        scaler.window_height = 600;
+        scaler.target_ms = RESOLUTION_TARGET_MS;
+        resolution_set_scale(&scaler, RESOLUTION_MAX_SCALE);
+
+        GLdouble fixed_ms = 1.0;
+        GLdouble pixel_ms = (full_frame_ms[g] - fixed_ms) / (800.0 * 600.0);
+        GLdouble in_flight[RESOLUTION_QUERY_RING] = { 0.0 };
+
+        GLuint frame, settled_at = 0, over_budget = 0;
+        GLdouble worst_ms = 0.0;
+        for (frame = 0; frame < BENCH_RESOLUTION_FRAMES; frame++) {
+            GLuint slot = frame % RESOLUTION_QUERY_RING;
+            if (frame >= RESOLUTION_QUERY_RING
+                && resolution_update(&scaler, in_flight[slot]) != RESOLUTION_HOLD)
+                settled_at = frame;
+
+            GLdouble ms = fixed_ms + pixel_ms * scaler.render_width * scaler.render_height;
+            ms *= 1.0 + 0.05 * bench_random(-1.0, 1.0);
+            in_flight[slot] = ms;
+
+            if (frame >= BENCH_RESOLUTION_FRAMES / 2) {
+                if (ms > worst_ms)
+                    worst_ms = ms;
+                if (ms > scaler.target_ms)
+                    over_budget += 1;
+            }
+        }
+
+        GLuint full_ms = (GLuint)full_frame_ms[g];
+        bench_result("fraction", scaler.scale, "resolution/%ums/scale", full_ms);
+        bench_result("count", settled_at, "resolution/%ums/last_change_frame", full_ms);
+        bench_result("count", scaler.scale_downs, "resolution/%ums/scale_downs", full_ms);
+        bench_result("count", scaler.scale_ups, "resolution/%ums/scale_ups", full_ms);
+        bench_result("ms", worst_ms, "resolution/%ums/worst_frame", full_ms);
+        bench_result("count", over_budget, "resolution/%ums/frames_over_budget", full_ms);
+    }
+}
+
+/* terrain_tex.obj resampled into a heightmap: size against the mesh, how
+ * far its surface strays from the mesh's, and query cost against the BVH;
+ * all null without the mesh */
+static void bench_heightmap() {
+    GLuint sizes[] = { 64, 128, 256, 512 };
+    GLuint s;
+
+    struct mesh_data mesh;
+    if (!load_mesh("terrain_tex.obj", &mesh, GL_TRUE)) {
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            bench_result("ms", NAN, "heightmap/%ux%u/convert", sizes[s], sizes[s]);
+            bench_result("bytes", NAN, "heightmap/%ux%u/size", sizes[s], sizes[s]);
+            bench_result("bytes", NAN, "heightmap/%ux%u/mesh_size", sizes[s], sizes[s]);
+            bench_result("units", NAN, "heightmap/%ux%u/mean_error", sizes[s], sizes[s]);
+            bench_result("units", NAN, "heightmap/%ux%u/max_error", sizes[s], sizes[s]);
+            bench_result("ns", NAN, "heightmap/%ux%u/height_query", sizes[s], sizes[s]);
+        }
+        return;
+    }
+
+    struct bvh tree;
+    bvh_build(&tree, mesh.vertices, mesh.elements);
+    size_t mesh_bytes = mesh.vertices.size() * (sizeof(struct arena_vertex) + sizeof(glm::vec4))
+                        + mesh.elements.size() * sizeof(GLushort);
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        struct heightmap map = heightmap();
+
+        double start = now_seconds();
+        heightmap_from_mesh(&map, &mesh, &tree, sizes[s], sizes[s]);
+        double convert_time = now_seconds() - start;
+
+        /* error where both have a surface */
+        glm::vec3 lo = tree.nodes[0].bounds_min, hi = tree.nodes[0].bounds_max;
+        vector<glm::vec2> points(BENCH_HEIGHTMAP_QUERIES);
+        GLuint i;
+        for (i = 0; i < BENCH_HEIGHTMAP_QUERIES; i++)
+            points[i] = glm::vec2(bench_random(lo.x, hi.x), bench_random(lo.z, hi.z));
+
+        GLdouble error_sum = 0.0, error_max = 0.0;
+        GLuint compared = 0;
+        for (i = 0; i < BENCH_HEIGHTMAP_QUERIES; i += 16) {
+            GLfloat mesh_height, map_height;
+            if (bvh_height_at(&tree, points[i].x, points[i].y, &mesh_height)
+                && heightmap_height_at(&map, points[i].x, points[i].y, &map_height)) {
+                GLdouble error = fabs(mesh_height - map_height);
+                error_sum += error;
+                error_max = max(error_max, error);
+                compared += 1;
+            }
+        }
+
+        vector<GLfloat> heights(BENCH_HEIGHTMAP_QUERIES);
+        start = now_seconds();
+        for (i = 0; i < BENCH_HEIGHTMAP_QUERIES; i++)
+            heightmap_height_at(&map, points[i].x, points[i].y, &heights[i]);
+        double height_time = now_seconds() - start;
+
+        bench_result("ms", convert_time * 1e3, "heightmap/%ux%u/convert", map.width, map.depth);
+        bench_result("bytes", heightmap_bytes(&map), "heightmap/%ux%u/size", map.width, map.depth);
+        bench_result("bytes", mesh_bytes, "heightmap/%ux%u/mesh_size", map.width, map.depth);
+        bench_result("units", compared ? error_sum / compared : 0.0, "heightmap/%ux%u/mean_error", map.width, map.depth);
+        bench_result("units", error_max, "heightmap/%ux%u/max_error", map.width, map.depth);
+        bench_result("ns", height_time * 1e9 / BENCH_HEIGHTMAP_QUERIES, "heightmap/%ux%u/height_query", map.width, map.depth);
+    }
+}
+
+/* the tiles/<mode>/... results of one tour; all null without a stream */
+static void bench_tile_stream_results(const char *mode,
+                                      const struct tile_stream *stream,
+                                      GLuint frames,
+                                      double update_time) {
+    /* update_ms is the per-frame visibility & residency pass (the terrain's culling) */
+    bench_result("count", stream ? frames : NAN, "tiles/%s/frames", mode);
+    bench_result("count", stream ? stream->num_slots : NAN, "tiles/%s/slots", mode);
+    bench_result("ms", stream ? update_time * 1e3 / frames : NAN, "tiles/%s/update", mode);
+    bench_result("count", stream ? stream->tile_misses : NAN, "tiles/%s/misses", mode);
+    bench_result("count", stream ? stream->miss_frames : NAN, "tiles/%s/miss_frames", mode);
+    bench_result("count", stream ? stream->tiles_loaded : NAN, "tiles/%s/loaded", mode);
+    bench_result("count", stream ? stream->tiles_evicted : NAN, "tiles/%s/evicted", mode);
+    bench_result("count", stream ? stream->tiles_dropped : NAN, "tiles/%s/dropped", mode);
+    bench_result("count", stream ? stream->tiles_cancelled : NAN, "tiles/%s/cancelled", mode);
+}
+
+/* a tour over a terrain too big for the residency budget, streamed from
+ * a tile file with simulated storage latency: misses with & without
+ * prefetching along the path. If the files can't be made or opened, every
+ * result is null (the names stay the same) */
+static void bench_tile_stream() {
+    string raw_path = bench_scratch("bench_terrain.r16"), tiles_path = bench_scratch("bench_terrain.tiles");
+
+    FILE *raw = fopen(raw_path.c_str(), "wb");
+    GLboolean ok = raw != NULL;
+    GLuint i, j;
+    if (raw) {
+        for (j = 0; j < BENCH_TILES_SIDE; j++) {
+            for (i = 0; i < BENCH_TILES_SIDE; i++) {
+                GLuint height = (GLuint)(32767.5 + 16000.0 * sin(i * 0.01) * cos(j * 0.013)
+                                         + 8000.0 * sin(i * 0.07 + j * 0.05));
+                fputc(height & 0xff, raw);
+                fputc(height >> 8, raw);
+            }
+        }
+        ok = fclose(raw) == 0;
+    }
+    if (!ok)
+        fprintf(stderr, "Unable to write %s\n", raw_path.c_str());
+
+    struct heightmap map = heightmap();
+    ok = ok && heightmap_load_raw(&map, raw_path.c_str(), HEIGHTMAP_RAW_SPACING, HEIGHTMAP_RAW_HEIGHT);
+    double start = now_seconds();
+    ok = ok && tile_file_write(&map, tiles_path.c_str());
+    double write_time = ok ? now_seconds() - start : NAN;
+
+    /* heights read back from the tiles, every one made resident, match the
+     * heightmap's */
+    GLfloat half = 0.5f * HEIGHTMAP_RAW_SPACING * (BENCH_TILES_SIDE - 1);
+    GLfloat max_error = NAN;
+    struct tile_stream check;
+    ok = ok && tile_stream_open(&check, tiles_path.c_str(), ~(size_t)0);
+    if (ok) {
+        GLfloat warm_x, warm_z;
+        for (warm_z = -half; warm_z < half + TILE_VIEW_RADIUS; warm_z += TILE_VIEW_RADIUS)
+            for (warm_x = -half; warm_x < half + TILE_VIEW_RADIUS; warm_x += TILE_VIEW_RADIUS)
+                tile_stream_warm(&check, glm::vec2(warm_x, warm_z));
+        check.uploads.clear();
+
+        max_error = 0.0f;
+        for (i = 0; i < 100000; i++) {
+            GLfloat x = bench_random(-half, half), z = bench_random(-half, half), a, b;
+            if (heightmap_height_at(&map, x, z, &a) && tile_stream_height_at(&check, x, z, &b))
+                max_error = max(max_error, fabsf(a - b));
+        }
+        tile_stream_close(&check);
+    }
+    bench_result("ms", write_time * 1e3, "tiles/%ux%u/write", BENCH_TILES_SIDE, BENCH_TILES_SIDE);
+    bench_result("units", max_error, "tiles/%ux%u/max_error", BENCH_TILES_SIDE, BENCH_TILES_SIDE);
+
+    /* a zig-zag tour across the terrain */
+    glm::vec2 stops[] = { glm::vec2(-0.8f, -0.8f), glm::vec2(0.8f, -0.4f), glm::vec2(-0.6f, 0.2f),
+                          glm::vec2(0.7f, 0.8f), glm::vec2(-0.8f, 0.8f) };
+    vector<glm::vec2> path;
+    GLuint s;
+    for (s = 0; s + 1 < sizeof(stops) / sizeof(stops[0]); s++) {
+        glm::vec2 from = stops[s] * half, to = stops[s + 1] * half;
+        GLuint steps = (GLuint)(glm::length(to - from) / BENCH_TILES_SPEED);
+        for (i = 0; i < steps; i++)
+            path.push_back(from + (to - from) * ((GLfloat)i / steps));
+    }
+    GLuint frames = min((GLuint)path.size(), (GLuint)BENCH_TILES_FRAMES);
+    GLuint lookahead = (GLuint)(TILE_PREFETCH_SECONDS / TILE_PREFETCH_STEP);
+    GLuint frames_per_step = (GLuint)(TILE_PREFETCH_STEP * 60.0);
+
+    GLuint prefetching;
+    for (prefetching = 0; prefetching < 2; prefetching++) {
+        const char *mode = prefetching ? "prefetch" : "no_prefetch";
+        struct tile_stream stream;
+        if (!ok || !tile_stream_open(&stream, tiles_path.c_str(), TILE_STREAM_BUDGET_MB * 1024 * 1024)) {
+            bench_tile_stream_results(mode, NULL, 0, 0.0);
+            continue;
+        }
+        stream.latency_ms = BENCH_TILES_LATENCY_MS;
+        tile_stream_warm(&stream, path[0]);
+        stream.uploads.clear();
+
+        vector<glm::vec2> upcoming;
+        double update_time = 0.0;
+        for (i = 0; i < frames; i++) {
+            upcoming.clear();
+            if (prefetching)
+                for (j = 1; j <= lookahead; j++)
+                    upcoming.push_back(path[min(i + j * frames_per_step, (GLuint)path.size() - 1)]);
+
+            start = now_seconds();
+            tile_stream_update(&stream, path[i], upcoming.empty() ? NULL : &upcoming[0], (GLuint)upcoming.size());
+            update_time += now_seconds() - start;
+            stream.uploads.clear();     /* no GL here */
+            this_thread::sleep_for(chrono::milliseconds(BENCH_TILES_FRAME_MS));
+        }
+
+        bench_tile_stream_results(mode, &stream, frames, update_time);
+        tile_stream_close(&stream);
+    }
+
+    remove(raw_path.c_str());
+    remove(tiles_path.c_str());
+}
+
+/* a heightfield with its triangles repeated `copies` times: indices are 16
+ * bits, so meshes past ~130k triangles have to share vertices */
+static void make_repeated_heightfield(GLuint size,
+                                      GLuint copies,
+                                      vector<glm::vec3> &vertices,
+                                      vector<GLushort> &elements) {
+    make_heightfield(size, BENCH_OBJ_EXTENT, vertices, elements);
+
+    size_t once = elements.size();
+    elements.reserve(once * copies);
+    GLuint c;
+    for (c = 1; c < copies; c++)
+        elements.insert(elements.end(), elements.begin(), elements.begin() + once);
+}
+
+/* the same mesh as an .obj file with texture co-ordinates (as terrain_tex.obj) */
+static GLboolean write_obj(const char *path,
+                           const vector<glm::vec3> &vertices,
+                           const vector<GLushort> &elements) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for writing\n", path);
+        return GL_FALSE;
+    }
+
+    size_t i;
+    for (i = 0; i < vertices.size(); i++)
+        fprintf(f, "v %f %f %f\n", vertices[i].x, vertices[i].y, vertices[i].z);
+    for (i = 0; i < vertices.size(); i++)
+        fprintf(f, "vt %f %f\n",
+                (vertices[i].x + BENCH_OBJ_EXTENT) / (2.0f * BENCH_OBJ_EXTENT),
+                (vertices[i].z + BENCH_OBJ_EXTENT) / (2.0f * BENCH_OBJ_EXTENT));
+    for (i = 0; i + 2 < elements.size(); i += 3)
+        fprintf(f, "f %u/%u %u/%u %u/%u\n",
+                elements[i] + 1, elements[i] + 1,
+                elements[i+1] + 1, elements[i+1] + 1,
+                elements[i+2] + 1, elements[i+2] + 1);
+
+    fclose(f);
+    return GL_TRUE;
+}
+
+/* whole-file reads (shaders, caches, hashing for hot reload) with a warm
+ * page cache: what file_contents itself costs */
+static void bench_file_contents() {
+    string scratch = bench_scratch("bench_file.bin");
+    const char *path = scratch.c_str();
+    GLuint sizes_kb[] = { 64, 1024, 16384, 65536 };
+    GLuint s;
+    for (s = 0; s < sizeof(sizes_kb) / sizeof(sizes_kb[0]); s++) {
+        size_t bytes = (size_t)sizes_kb[s] * 1024;
+        FILE *f = fopen(path, "wb");
+        if (!f) {
+            fprintf(stderr, "Unable to open %s for writing\n", path);
+            bench_result("ms", NAN, "file_contents/%uKB/read", sizes_kb[s]);
+            bench_result("MB/s", NAN, "file_contents/%uKB/throughput", sizes_kb[s]);
+            continue;
+        }
+        vector<char> block(65536);
+        size_t i;
+        for (i = 0; i < block.size(); i++)
+            block[i] = (char)bench_random(32.0f, 127.0f);
+        for (i = 0; i < bytes; i += block.size())
+            fwrite(&block[0], 1, min(block.size(), bytes - i), f);
+        fclose(f);
+
+        GLuint reads = (GLuint)max((size_t)4, (size_t)BENCH_FILE_BYTES / bytes);
+        GLint length = 0;
+        free(file_contents(path, &length));    /* into the page cache */
+
+        double start = now_seconds();
+        GLuint r;
+        for (r = 0; r < reads; r++)
+            free(file_contents(path, &length));
+        double read_time = (now_seconds() - start) / reads;
+
+        bench_result("ms", read_time * 1e3, "file_contents/%uKB/read", sizes_kb[s]);
+        bench_result("MB/s", bytes / read_time / (1024.0 * 1024.0), "file_contents/%uKB/throughput", sizes_kb[s]);
+    }
+
+    remove(path);
+}
+
+/* .obj parsing, from a few hundred to a few million triangles */
+static void bench_load_obj() {
+    string scratch = bench_scratch("bench_mesh.obj");
+    const char *path = scratch.c_str();
+    GLuint sizes[] = { 16, 64, 255, 255 };
+    GLuint copies[] = { 1, 1, 1, 16 };
+    GLuint s;
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        vector<glm::vec3> mesh_vertices;
+        vector<GLushort> mesh_elements;
+        make_repeated_heightfield(sizes[s], copies[s], mesh_vertices, mesh_elements);
+        GLuint triangles = (GLuint)mesh_elements.size() / 3;
+        if (!write_obj(path, mesh_vertices, mesh_elements)) {
+            bench_result("count", triangles, "load_obj/%u_tris/triangles", triangles);
+            bench_result("ms", NAN, "load_obj/%u_tris/load", triangles);
+            bench_result("ns", NAN, "load_obj/%u_tris/per_triangle", triangles);
+            continue;
+        }
+
+        vector<glm::vec3> vertices, normals;
+        vector<glm::vec2> tex_coords;
+        vector<GLushort> elements;
+        double start = now_seconds();
+        GLboolean loaded = load_obj(path, vertices, tex_coords, normals, elements, GL_TRUE);
+        double load_time = loaded ? now_seconds() - start : NAN;
+
+        bench_result("count", triangles, "load_obj/%u_tris/triangles", triangles);
+        bench_result("ms", load_time * 1e3, "load_obj/%u_tris/load", triangles);
+        bench_result("ns", load_time * 1e9 / triangles, "load_obj/%u_tris/per_triangle", triangles);
+    }
+
+    remove(path);
+}
+
+/* per-vertex normal generation (the tail of load_obj) */
+static void bench_normals() {
+    GLuint sizes[] = { 16, 64, 255, 255, 255 };
+    GLuint copies[] = { 1, 1, 1, 16, 32 };
+    GLuint s;
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        vector<glm::vec3> vertices, normals;
+        vector<GLushort> elements;
+        make_repeated_heightfield(sizes[s], copies[s], vertices, elements);
+        GLuint triangles = (GLuint)elements.size() / 3;
+        GLuint repeats = max(1u, BENCH_NORMAL_TRIANGLES / triangles);
+
+        double start = now_seconds();
+        GLuint r;
+        for (r = 0; r < repeats; r++) {
+            normals.clear();
+            mesh_generate_normals(vertices, elements, normals);
+        }
+        double normal_time = (now_seconds() - start) / repeats;
+
+        bench_result("ms", normal_time * 1e3, "normals/%u_tris/generate", triangles);
+        bench_result("ns", normal_time * 1e9 / triangles, "normals/%u_tris/per_triangle", triangles);
+    }
+}
+
+/* the camera tour, as timer_camera runs it every frame: step along the
+ * current stage, then rebuild the view matrix; and the prefetch lookahead */
+static void bench_camera_tour() {
+    struct camera tour_camera = camera();
+    tour_camera.position = glm::vec3(-5.328159, 0.400000, -7.339204);
+    tour_camera.angles = glm::vec2(1.0, 0.0);
+    tour_camera.up = glm::vec3(0.0, 1.0, 0.0);
+    tour_camera.rate = 1.0;
+    tour_camera.stopped = GL_TRUE;
+    camera_add_stage(&tour_camera, glm::vec3(-3.158986, 0.600000, -5.130444), 1.0, 3.0);
+    camera_add_stage(&tour_camera, glm::vec3(-0.939203, 0.800000, -2.144298), 3.0, 5.0);
+    camera_add_stage(&tour_camera, glm::vec3(2.036759, 1.200000, -5.792756), -0.9, 5.0);
+    camera_add_stage(&tour_camera, glm::vec3(2.339581, 1.200000, -8.596780), -0.460386, 3.0);
+    camera_add_stage(&tour_camera, glm::vec3(-5.328159, 0.400000, -7.339204), 1.0, 3.0);
+
+    GLuint frame, tours = 0;
+    GLfloat checksum = 0.0f;
+    double start = now_seconds();
+    for (frame = 0; frame < BENCH_TOUR_FRAMES; frame++) {
+        if (tour_camera.stopped) {
+            camera_start_tour(&tour_camera);
+            tours += 1;
+        }
+        camera_tour_step(&tour_camera, 1.0 / 60.0);
+        checksum += camera_view_matrix(&tour_camera)[3][0];
+    }
+    double step_time = now_seconds() - start;
+
+    vector<glm::vec3> ahead;
+    tour_camera.stopped = GL_TRUE;
+    camera_start_tour(&tour_camera);
+    start = now_seconds();
+    for (frame = 0; frame < BENCH_TOUR_LOOKAHEADS; frame++) {
+        if (tour_camera.stopped)
+            camera_start_tour(&tour_camera);
+        camera_tour_step(&tour_camera, 1.0 / 60.0);
+        ahead.clear();
+        camera_tour_ahead(&tour_camera, TILE_PREFETCH_SECONDS, TILE_PREFETCH_STEP, ahead);
+        checksum += ahead.empty() ? 0.0f : ahead.back().x;
+    }
+    double ahead_time = now_seconds() - start;
+
+    bench_result("ns", step_time * 1e9 / BENCH_TOUR_FRAMES, "camera_tour/%u_stages/step_and_view", tour_camera.num_stages);
+    bench_result("count", tours, "camera_tour/%u_stages/tours", tour_camera.num_stages);
+    bench_result("ns", ahead_time * 1e9 / BENCH_TOUR_LOOKAHEADS, "camera_tour/%u_stages/step_and_lookahead", tour_camera.num_stages);
+    if (checksum == 12345.0f)   /* keep the work from being optimised away */
+        fprintf(stderr, "checksum %f\n", checksum);
+}
+
+/* model_render's CPU side without a context: sorting models into passes
+ * (program, texture, material) and gathering each multi-draw batch's
+ * matrices from the scene store */
+static void bench_model_render() {
+    GLuint counts[] = { 1000, 16000, 100000 };
+    GLuint c;
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        GLuint count = counts[c];
+        struct scene_store store = scene_store();
+        scene_store_reserve(&store, count);
+
+        vector<struct model> models(count);
+        vector<struct model *> shuffled(count), order(count);
+        GLuint i;
+        for (i = 0; i < count; i++) {
+            struct model *m = &models[i];
+            m->program = 1 + (GLuint)bench_random(0.0f, BENCH_MODEL_PROGRAMS);
+            m->texture = 1 + (GLuint)bench_random(0.0f, BENCH_MODEL_TEXTURES);
+            m->layer = 0;
+            m->material.ambient = glm::vec3(0.05f + 0.05f * (GLuint)bench_random(0.0f, 4.0f));
+            m->entity = scene_store_create(&store, SCENE_NO_PARENT);
+            scene_store_set_position(&store, m->entity, glm::vec3(bench_random(-10.0f, 10.0f), 0.0,
+                                                                  bench_random(-10.0f, 10.0f)));
+            shuffled[i] = m;
+        }
+        scene_store_update(&store);
+        for (i = count - 1; i > 0; i--)
+            swap(shuffled[i], shuffled[(GLuint)bench_random(0.0f, (GLfloat)i + 1.0f) % (i + 1)]);
+
+        double sort_time = 0.0, pass_time = 0.0, batch_time = 0.0;
+        GLuint passes = 0;
+        GLfloat checksum = 0.0f;
+        glm::mat4 model_matrices[ARENA_MAX_DRAWS];
+        glm::mat3 normal_matrices[ARENA_MAX_DRAWS];
+        GLint layers[ARENA_MAX_DRAWS];
+
+        GLuint r;
+        for (r = 0; r < BENCH_MODEL_REPEATS; r++) {
+            order = shuffled;
+
+            double start = now_seconds();
+            model_sort_passes(&order[0], count);
+            sort_time += now_seconds() - start;
+
+            vector<GLuint> pass_ends;
+            start = now_seconds();
+            GLuint first, end;
+            for (first = 0; first < count; first = end) {
+                end = model_pass_end(&order[0], first, count);
+                pass_ends.push_back(end);
+            }
+            pass_time += now_seconds() - start;
+            passes = (GLuint)pass_ends.size();
+
+            start = now_seconds();
+            first = 0;
+            GLuint p;
+            for (p = 0; p < passes; p++) {
+                GLuint batch_first;
+                for (batch_first = first; batch_first < pass_ends[p]; batch_first += ARENA_MAX_DRAWS) {
+                    GLuint batch = min((GLuint)ARENA_MAX_DRAWS, pass_ends[p] - batch_first);
+                    model_batch_uniforms(&store, &order[batch_first], batch,
+                                         model_matrices, normal_matrices, layers);
+                    checksum += model_matrices[batch - 1][3][0];
+                }
+                first = pass_ends[p];
+            }
+            batch_time += now_seconds() - start;
+        }
+
+        bench_result("count", passes, "model_render/%u_models/passes", count);
+        bench_result("ns", sort_time * 1e9 / BENCH_MODEL_REPEATS / count, "model_render/%u_models/sort", count);
+        bench_result("ns", pass_time * 1e9 / BENCH_MODEL_REPEATS / count, "model_render/%u_models/split_passes", count);
+        bench_result("ns", batch_time * 1e9 / BENCH_MODEL_REPEATS / count, "model_render/%u_models/batch_matrices", count);
+        if (checksum == 12345.0f)
+            fprintf(stderr, "checksum %f\n", checksum);
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*run)();
+} bench_groups[] = {
+    { "file_contents", bench_file_contents },
+    { "load_obj", bench_load_obj },
+    { "normals", bench_normals },
+    { "camera_tour", bench_camera_tour },
+    { "model_render", bench_model_render },
+    { "bvh", bench_terrain_index },
+    { "scene_store", bench_scene_store },
+    { "bake", bench_bake },
+    { "softrast", bench_softrast },
+    { "arena", bench_arena },
+    { "resolution", bench_resolution },
+    { "heightmap", bench_heightmap },
+    { "tiles", bench_tile_stream },
+};
+
+int main(int argc, char **argv) {
+    vector<const char *> groups;
+    const char *out_path = NULL;
+    int arg;
+    const char *tmpdir = getenv("TMPDIR");
+    bench_scratch_dir = (tmpdir && tmpdir[0]) ? tmpdir : "/tmp";
+
+    size_t g, i;
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+            out_path = argv[++arg];
+            continue;
+        }
+        if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+            bench_scratch_dir = argv[++arg];
+            continue;
+        }
+
+        for (g = 0; g < sizeof(bench_groups) / sizeof(bench_groups[0]); g++)
+            if (strcmp(argv[arg], bench_groups[g].name) == 0)
+                break;
+        if (g == sizeof(bench_groups) / sizeof(bench_groups[0])) {
+            fprintf(stderr, "Unknown benchmark group \"%s\"; the groups are:", argv[arg]);
+            for (g = 0; g < sizeof(bench_groups) / sizeof(bench_groups[0]); g++)
+                fprintf(stderr, " %s", bench_groups[g].name);
+            fprintf(stderr, "\nusage: mars_bench [-o file.json] [-t scratch_dir] [group...]\n");
+            return EXIT_FAILURE;
+        }
+        groups.push_back(argv[arg]);
+    }
+
+    /* JSON only on stdout: keep a copy of it, point the real one at stderr */
+    if (out_path)
+        bench_out = fopen(out_path, "w");
+    else {
+        bench_out = fdopen(dup(STDOUT_FILENO), "w");
+        fflush(stdout);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    if (!bench_out) {
+        fprintf(stderr, "Unable to open %s for writing\n", out_path ? out_path : "stdout");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(bench_out, "{\n  \"context\": {\"version\": %d, \"hardware_threads\": %u, \"optimized\": %s},\n",
+            BENCH_JSON_VERSION, thread::hardware_concurrency(),
+#ifdef __OPTIMIZE__
+            "true"
+#else
+            "false"
+#endif
+            );
+    fprintf(bench_out, "  \"results\": [");
+
+    for (g = 0; g < sizeof(bench_groups) / sizeof(bench_groups[0]); g++) {
+        GLboolean selected = groups.empty();
+        for (i = 0; i < groups.size(); i++)
+            selected |= strcmp(groups[i], bench_groups[g].name) == 0;
+        if (!selected)
+            continue;
+
+        fprintf(stderr, "%s...\n", bench_groups[g].name);
+        bench_groups[g].run();
+        fflush(bench_out);
+    }
+
+    fprintf(bench_out, "\n  ]\n}\n");
+    fclose(bench_out);
+    return EXIT_SUCCESS;
+}
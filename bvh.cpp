@@ -0,0 +1,354 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <float.h>
+
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+
+using namespace std;
+
+/*
+ * Bounding volume hierarchy over a static triangle mesh. Built once at load
+ * time; queries are read-only so may be issued from several threads.
+ */
+
+/* orders triangle indices by their centroid along one axis */
+struct centroid_less {
+    const vector<glm::vec3> *centroids;
+    int axis;
+
+    bool operator()(GLuint a, GLuint b) const {
+        return (*centroids)[a][axis] < (*centroids)[b][axis];
+    }
+};
+
+/* recursively split triangles [start, start+count) of `order` under node_idx,
+ * which is `depth` levels below the root */
+static void bvh_build_node(struct bvh *tree,
+                           GLuint node_idx,
+                           vector<GLuint> &order,
+                           const vector<glm::vec3> &centroids,
+                           const vector<glm::vec3> &corners,
+                           GLuint start,
+                           GLuint count,
+                           GLuint depth) {
+    glm::vec3 bounds_min = glm::vec3(FLT_MAX);
+    glm::vec3 bounds_max = glm::vec3(-FLT_MAX);
+    glm::vec3 centroid_min = glm::vec3(FLT_MAX);
+    glm::vec3 centroid_max = glm::vec3(-FLT_MAX);
+
+    GLuint i;
+    for (i = start; i < start + count; i++) {
+        GLuint tri = order[i];
+        bounds_min = glm::min(bounds_min, glm::min(corners[tri*3], glm::min(corners[tri*3+1], corners[tri*3+2])));
+        bounds_max = glm::max(bounds_max, glm::max(corners[tri*3], glm::max(corners[tri*3+1], corners[tri*3+2])));
+        centroid_min = glm::min(centroid_min, centroids[tri]);
+        centroid_max = glm::max(centroid_max, centroids[tri]);
+    }
+
+    tree->nodes[node_idx].bounds_min = bounds_min;
+    tree->nodes[node_idx].bounds_max = bounds_max;
+
+    /* a traversal holds at most depth + 2 entries (each internal node
+     * swaps itself for its two children), so stop splitting before that
+     * outgrows BVH_STACK_DEPTH. Median splits of a GLuint triangle count
+     * stay within 32 levels, but a bigger leaf would still be correct */
+    if (count <= BVH_LEAF_TRIANGLES || depth + 2 > BVH_STACK_DEPTH) {
+        tree->nodes[node_idx].first = start;
+        tree->nodes[node_idx].count = count;
+        return;
+    }
+
+    /* split at the median centroid along the widest axis */
+    glm::vec3 extent = centroid_max - centroid_min;
+    int axis = 0;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    GLuint half = count / 2;
+    centroid_less less = { &centroids, axis };
+    nth_element(order.begin() + start,
+                order.begin() + start + half,
+                order.begin() + start + count,
+                less);
+
+    GLuint left = (GLuint)tree->nodes.size();
+    tree->nodes.resize(left + 2);
+    tree->nodes[node_idx].first = left;
+    tree->nodes[node_idx].count = 0;
+
+    bvh_build_node(tree, left, order, centroids, corners, start, half, depth + 1);
+    bvh_build_node(tree, left + 1, order, centroids, corners, start + half, count - half, depth + 1);
+}
+
+/* build the hierarchy over a triangle soup: 3 consecutive corners per triangle */
+void bvh_build_triangles(struct bvh *tree,
+                         const vector<glm::vec3> &corners) {
+    GLuint num_triangles = (GLuint)(corners.size() / 3);
+
+    tree->nodes.clear();
+    tree->triangles.clear();
+    if (num_triangles == 0)
+        return;
+
+    vector<glm::vec3> centroids(num_triangles);
+    vector<GLuint> order(num_triangles);
+
+    GLuint i;
+    for (i = 0; i < num_triangles; i++) {
+        centroids[i] = (corners[i*3] + corners[i*3+1] + corners[i*3+2]) / 3.0f;
+        order[i] = i;
+    }
+
+    tree->nodes.reserve(2 * num_triangles);
+    tree->nodes.resize(1);
+    bvh_build_node(tree, 0, order, centroids, corners, 0, num_triangles, 0);
+
+    /* store triangle vertices in leaf order so leaves read contiguous memory */
+    tree->triangles.resize(num_triangles * 3);
+    for (i = 0; i < num_triangles; i++) {
+        tree->triangles[i*3] = corners[order[i]*3];
+        tree->triangles[i*3+1] = corners[order[i]*3+1];
+        tree->triangles[i*3+2] = corners[order[i]*3+2];
+    }
+}
+
+/* build the hierarchy over an indexed triangle list (as produced by load_obj) */
+void bvh_build(struct bvh *tree,
+               const vector<glm::vec3> &vertices,
+               const vector<GLushort> &elements) {
+    vector<glm::vec3> corners(elements.size() - elements.size() % 3);
+
+    GLuint i;
+    for (i = 0; i < corners.size(); i++)
+        corners[i] = vertices[elements[i]];
+
+    bvh_build_triangles(tree, corners);
+}
+
+/* slab test; returns entry distance, or FLT_MAX on a miss */
+static inline GLfloat ray_box(const struct bvh_node *node,
+                              glm::vec3 origin,
+                              glm::vec3 inv_direction,
+                              GLfloat max_distance) {
+    glm::vec3 t0 = (node->bounds_min - origin) * inv_direction;
+    glm::vec3 t1 = (node->bounds_max - origin) * inv_direction;
+    glm::vec3 t_near = glm::min(t0, t1);
+    glm::vec3 t_far = glm::max(t0, t1);
+
+    GLfloat enter = max(max(t_near.x, t_near.y), max(t_near.z, 0.0f));
+    GLfloat exit = min(min(t_far.x, t_far.y), min(t_far.z, max_distance));
+
+    return (enter <= exit) ? enter : FLT_MAX;
+}
+
+/* Moller-Trumbore ray/triangle test */
+static inline GLboolean ray_triangle(const glm::vec3 *tri,
+                                     glm::vec3 origin,
+                                     glm::vec3 direction,
+                                     GLfloat *distance) {
+    glm::vec3 edge_1 = tri[1] - tri[0];
+    glm::vec3 edge_2 = tri[2] - tri[0];
+    glm::vec3 p = glm::cross(direction, edge_2);
+    GLfloat det = glm::dot(edge_1, p);
+
+    if (fabsf(det) < 1e-12f)
+        return GL_FALSE;
+
+    GLfloat inv_det = 1.0f / det;
+    glm::vec3 s = origin - tri[0];
+    GLfloat u = glm::dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f)
+        return GL_FALSE;
+
+    glm::vec3 q = glm::cross(s, edge_1);
+    GLfloat v = glm::dot(direction, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f)
+        return GL_FALSE;
+
+    *distance = glm::dot(edge_2, q) * inv_det;
+    return *distance >= 0.0f;
+}
+
+/* nearest intersection of a ray with the mesh, no further than max_distance */
+GLboolean bvh_intersect_ray(const struct bvh *tree,
+                            glm::vec3 origin,
+                            glm::vec3 direction,
+                            GLfloat max_distance,
+                            struct bvh_hit *hit) {
+    if (tree->nodes.empty())
+        return GL_FALSE;
+
+    glm::vec3 inv_direction = glm::vec3(1.0f / direction.x,
+                                        1.0f / direction.y,
+                                        1.0f / direction.z);
+    GLfloat best = max_distance;
+    GLuint best_triangle = 0;
+    GLboolean found = GL_FALSE;
+
+    GLuint stack[BVH_STACK_DEPTH];
+    int top = 0;
+
+    if (ray_box(&tree->nodes[0], origin, inv_direction, best) == FLT_MAX)
+        return GL_FALSE;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const struct bvh_node *node = &tree->nodes[stack[--top]];
+
+        if (node->count > 0) {
+            GLuint i;
+            for (i = node->first; i < node->first + node->count; i++) {
+                GLfloat t;
+                if (ray_triangle(&tree->triangles[i*3], origin, direction, &t) && t < best) {
+                    best = t;
+                    best_triangle = i;
+                    found = GL_TRUE;
+                }
+            }
+            continue;
+        }
+
+        /* visit the nearer child first: push it last */
+        GLuint near_child = node->first;
+        GLuint far_child = node->first + 1;
+        GLfloat t_near = ray_box(&tree->nodes[near_child], origin, inv_direction, best);
+        GLfloat t_far = ray_box(&tree->nodes[far_child], origin, inv_direction, best);
+        if (t_far < t_near) {
+            swap(near_child, far_child);
+            swap(t_near, t_far);
+        }
+
+        if (t_far != FLT_MAX)
+            stack[top++] = far_child;
+        if (t_near != FLT_MAX)
+            stack[top++] = near_child;
+    }
+
+    if (found && hit) {
+        const glm::vec3 *tri = &tree->triangles[best_triangle*3];
+        hit->distance = best;
+        hit->triangle = best_triangle;
+        hit->position = origin + direction * best;
+        hit->normal = glm::normalize(glm::cross(tri[1] - tri[0], tri[2] - tri[0]));
+    }
+
+    return found;
+}
+
+/* any-hit test, for shadow & occlusion rays: GL_TRUE if anything lies
+ * along the ray within max_distance */
+GLboolean bvh_occluded(const struct bvh *tree,
+                       glm::vec3 origin,
+                       glm::vec3 direction,
+                       GLfloat max_distance) {
+    if (tree->nodes.empty())
+        return GL_FALSE;
+
+    glm::vec3 inv_direction = glm::vec3(1.0f / direction.x,
+                                        1.0f / direction.y,
+                                        1.0f / direction.z);
+
+    GLuint stack[BVH_STACK_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const struct bvh_node *node = &tree->nodes[stack[--top]];
+
+        if (ray_box(node, origin, inv_direction, max_distance) == FLT_MAX)
+            continue;
+
+        if (node->count == 0) {
+            stack[top++] = node->first + 1;
+            stack[top++] = node->first;
+            continue;
+        }
+
+        GLuint i;
+        for (i = node->first; i < node->first + node->count; i++) {
+            GLfloat t;
+            if (ray_triangle(&tree->triangles[i*3], origin, direction, &t) && t < max_distance)
+                return GL_TRUE;
+        }
+    }
+
+    return GL_FALSE;
+}
+
+/* height of the highest surface directly above/below (x, z), in model space.
+ * This is a vertical ray cast, done in 2D: nodes are culled on their x/z
+ * extent only and triangles by barycentric containment of the point */
+GLboolean bvh_height_at(const struct bvh *tree,
+                        GLfloat x,
+                        GLfloat z,
+                        GLfloat *height) {
+    if (tree->nodes.empty())
+        return GL_FALSE;
+
+    GLfloat best = -FLT_MAX;
+    GLboolean found = GL_FALSE;
+
+    GLuint stack[BVH_STACK_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const struct bvh_node *node = &tree->nodes[stack[--top]];
+
+        if (x < node->bounds_min.x || x > node->bounds_max.x ||
+            z < node->bounds_min.z || z > node->bounds_max.z ||
+            node->bounds_max.y <= best)
+            continue;
+
+        if (node->count == 0) {
+            stack[top++] = node->first + 1;
+            stack[top++] = node->first;
+            continue;
+        }
+
+        GLuint i;
+        for (i = node->first; i < node->first + node->count; i++) {
+            const glm::vec3 *tri = &tree->triangles[i*3];
+            GLfloat d1x = tri[1].x - tri[0].x, d1z = tri[1].z - tri[0].z;
+            GLfloat d2x = tri[2].x - tri[0].x, d2z = tri[2].z - tri[0].z;
+            GLfloat det = d1x * d2z - d2x * d1z;
+
+            if (fabsf(det) < 1e-12f)   /* vertical triangle */
+                continue;
+
+            GLfloat px = x - tri[0].x, pz = z - tri[0].z;
+            GLfloat u = (px * d2z - d2x * pz) / det;
+            GLfloat v = (d1x * pz - px * d1z) / det;
+            if (u < 0.0f || v < 0.0f || u + v > 1.0f)
+                continue;
+
+            GLfloat y = tri[0].y + u * (tri[1].y - tri[0].y) + v * (tri[2].y - tri[0].y);
+            if (y > best) {
+                best = y;
+                found = GL_TRUE;
+            }
+        }
+    }
+
+    if (found)
+        *height = best;
+    return found;
+}
+
+/* batched height queries; points outside the mesh get `fallback` */
+void bvh_heights_at(const struct bvh *tree,
+                    const glm::vec2 *points,
+                    GLfloat *heights,
+                    GLuint count,
+                    GLfloat fallback) {
+    GLuint i;
+    for (i = 0; i < count; i++) {
+        if (!bvh_height_at(tree, points[i].x, points[i].y, &heights[i]))
+            heights[i] = fallback;
+    }
+}
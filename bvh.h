@@ -0,0 +1,54 @@
+#define BVH_LEAF_TRIANGLES 4
+#define BVH_STACK_DEPTH 64     /* traversal stack; nodes this deep are made leaves, so it never overflows */
+
+/* structure definitions */
+struct bvh_node {
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+    GLuint first;   /* leaf: first triangle; internal: index of left child (right is first+1) */
+    GLuint count;   /* number of triangles in a leaf, 0 for internal nodes */
+};
+
+/* bounding volume hierarchy over a triangle mesh (in model space), used for
+ * height-at-(x,z) queries and ray picking against the terrain */
+struct bvh {
+    std::vector<struct bvh_node> nodes;
+    std::vector<glm::vec3> triangles;   /* 3 vertices per triangle, in leaf order */
+};
+
+struct bvh_hit {
+    GLfloat distance;       /* along the ray, in units of the direction vector */
+    GLuint triangle;
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+/* function prototypes */
+void bvh_build(struct bvh *tree,
+               const std::vector<glm::vec3> &vertices,
+               const std::vector<GLushort> &elements);
+
+void bvh_build_triangles(struct bvh *tree,
+                         const std::vector<glm::vec3> &corners);
+
+GLboolean bvh_intersect_ray(const struct bvh *tree,
+                            glm::vec3 origin,
+                            glm::vec3 direction,
+                            GLfloat max_distance,
+                            struct bvh_hit *hit);
+
+GLboolean bvh_occluded(const struct bvh *tree,
+                       glm::vec3 origin,
+                       glm::vec3 direction,
+                       GLfloat max_distance);
+
+GLboolean bvh_height_at(const struct bvh *tree,
+                        GLfloat x,
+                        GLfloat z,
+                        GLfloat *height);
+
+void bvh_heights_at(const struct bvh *tree,
+                    const glm::vec2 *points,
+                    GLfloat *heights,
+                    GLuint count,
+                    GLfloat fallback);
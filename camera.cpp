@@ -0,0 +1,159 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "util.h"
+#include "camera.h"
+
+using namespace std;
+
+/*
+ * The camera's tour: straight-line stages between programmed points,
+ * turning as it goes. Nothing here needs a window, so bench.cpp can time it.
+ */
+
+/* add a stage to the camera's tour */
+void camera_add_stage(struct camera *camera,
+                      glm::vec3 to_point,
+                      GLfloat to_angle,
+                      GLfloat duration) {
+    int i = camera->num_stages;
+    if (i < MAX_CAMERA_ACTIONS) {
+        if (i == 0) {/* first: start is initial camera position */
+            camera->tour[i].start = camera->position;
+            camera->tour[i].start_angle = camera->angles.x;
+        }
+        else { /* o/w, use end of previous camera action */
+            camera->tour[i].start = camera->tour[i-1].end;
+            camera->tour[i].start_angle = camera->tour[i-1].end_angle;
+        }
+        
+        camera->tour[i].end = to_point;
+        camera->tour[i].end_angle = to_angle;
+        camera->tour[i].duration = duration;
+        
+        camera->num_stages += 1;
+    }
+    else {
+        fprintf(stderr, "Too many camera actions\n");
+    }
+}
+
+/* change the rate of the camera motion (compared to how it was programmed)... but not < 0 */
+void camera_rate(struct camera *camera,
+                 GLfloat delta) {
+    fprintf(stderr, "camera rate %f\n", camera->rate);
+    if (camera->rate + delta <= 0.2) {
+        return;
+    }
+    
+    camera->rate += delta;
+    
+    int i;
+    for (i = 0; i < camera->num_stages; i++) {
+        camera->tour[i].duration /= camera->rate;
+        camera->tour[i].time_elapsed /= camera->rate;        
+    }
+}
+
+/* unit vector the camera is looking along */
+glm::vec3 camera_lookat_direction(const struct camera *camera) {
+    glm::vec3 lookat;
+    lookat.x = sinf(camera->angles.x) * cosf(camera->angles.y);
+    lookat.y = sinf(camera->angles.y);
+    lookat.z = cosf(camera->angles.x) * cosf(camera->angles.y);
+    
+    return lookat;
+}
+
+glm::mat4 camera_view_matrix(const struct camera *camera) {
+    glm::vec3 lookat = camera_lookat_direction(camera);
+    
+    return glm::lookAt(camera->position,
+                       camera->position + lookat,
+                       camera->up);
+}
+
+/* (re)start the camera tour from the beginning, at the programmed speed */
+void camera_start_tour(struct camera *camera) {
+    if(camera->stopped) {
+        int i;
+        for (i = 0; i < camera->num_stages; i++) {
+            camera->tour[i].time_elapsed = 0.0;
+            camera->tour[i].duration *= camera->rate;
+        }
+        camera->rate = 1.0;
+        camera->current_stage = 0;
+        camera->position = camera->tour[0].start;
+        camera->stopped = GL_FALSE;
+    }
+}
+
+/* move the camera delta seconds along its tour; stops it at the end */
+void camera_tour_step(struct camera *camera,
+                      GLdouble delta) {
+    if(camera->stopped)
+        return;
+    
+    // if this stage has finished
+    if (camera->tour[camera->current_stage].time_elapsed
+        > camera->tour[camera->current_stage].duration) {
+        
+        // place it at the end point (otherwise it may overshoot)
+        camera->position = camera->tour[camera->current_stage].end;
+        
+        if (camera->current_stage == camera->num_stages - 1) {
+            // if it's the last stage
+            camera->stopped = GL_TRUE;
+            return;
+        }
+        else {
+            // otherwise, progress to next stage
+            camera->current_stage += 1;
+        }
+    }
+    
+    int i = camera->current_stage;
+    glm::vec3 delta_vector = camera->tour[i].end - camera->tour[i].start;
+    delta_vector *= (camera->tour[i].time_elapsed / camera->tour[i].duration);
+    camera->position = camera->tour[i].start + delta_vector;
+    
+
+    GLfloat delta_angle = camera->tour[i].end_angle - camera->tour[i].start_angle;
+    delta_angle *= (camera->tour[i].time_elapsed / camera->tour[i].duration);
+    
+    camera->angles.x = camera->tour[i].start_angle + delta_angle;
+    
+    camera->tour[i].time_elapsed += delta;
+}
+
+/* where the tour will take the camera over the next few seconds, every
+ * step seconds (nothing when the tour isn't running) */
+void camera_tour_ahead(const struct camera *camera,
+                       GLdouble seconds,
+                       GLdouble step,
+                       vector<glm::vec3> &points) {
+    if (camera->stopped)
+        return;
+    
+    GLuint stage = camera->current_stage;
+    GLdouble elapsed = camera->tour[stage].time_elapsed;
+    GLdouble ahead;
+    for (ahead = step; ahead <= seconds; ahead += step) {
+        elapsed += step;
+        while (elapsed > camera->tour[stage].duration && stage + 1 < camera->num_stages) {
+            elapsed -= camera->tour[stage].duration;
+            stage += 1;
+        }
+        
+        GLfloat t = (GLfloat)min(elapsed / camera->tour[stage].duration, 1.0);
+        points.push_back(camera->tour[stage].start
+                         + (camera->tour[stage].end - camera->tour[stage].start) * t);
+    }
+}
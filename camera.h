@@ -0,0 +1,18 @@
+/* function prototypes */
+void camera_add_stage(struct camera *camera,
+                      glm::vec3 to_point,
+                      GLfloat to_angle,
+                      GLfloat duration);
+void camera_rate(struct camera *camera,
+                 GLfloat delta);
+
+glm::vec3 camera_lookat_direction(const struct camera *camera);
+glm::mat4 camera_view_matrix(const struct camera *camera);
+
+void camera_start_tour(struct camera *camera);
+void camera_tour_step(struct camera *camera,
+                      GLdouble delta);
+void camera_tour_ahead(const struct camera *camera,
+                       GLdouble seconds,
+                       GLdouble step,
+                       std::vector<glm::vec3> &points);
@@ -0,0 +1,229 @@
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GL/glfw.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture.h"
+
+using namespace std;
+
+/*
+ * Frame capture for recording the tour. A synchronous glReadPixels waits
+ * for the GPU to finish the frame; reading into a pixel buffer object
+ * instead returns immediately, and by the time the buffer is mapped a
+ * couple of frames later the copy has long completed.
+ */
+
+/* write one frame, flipped so the top row comes first */
+static GLboolean capture_write(struct capture *recorder,
+                               const struct captured_frame *frame,
+                               vector<GLubyte> &row) {
+    FILE *out = recorder->raw;
+    if (recorder->format == CAPTURE_PPM) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s%05u.ppm", recorder->path.c_str(), frame->number);
+        out = fopen(path, "wb");
+        if (!out) {
+            fprintf(stderr, "Unable to open %s for writing\n", path);
+            return GL_FALSE;
+        }
+        fprintf(out, "P6\n%u %u\n255\n", recorder->width, recorder->height);
+    }
+
+    GLuint x, y;
+    for (y = 0; y < recorder->height; y++) {
+        const GLubyte *rgba = &frame->pixels[(size_t)(recorder->height - 1 - y) * recorder->width * 4];
+        for (x = 0; x < recorder->width; x++) {
+            row[x*3] = rgba[x*4];
+            row[x*3+1] = rgba[x*4+1];
+            row[x*3+2] = rgba[x*4+2];
+        }
+        fwrite(&row[0], 3, recorder->width, out);
+    }
+
+    if (recorder->format == CAPTURE_PPM)
+        fclose(out);
+    return GL_TRUE;
+}
+
+/* encoder thread: write queued frames until told to stop and the queue is empty */
+static void capture_encode(struct capture *recorder) {
+    vector<GLubyte> row(recorder->width * 3);
+
+    for (;;) {
+        struct captured_frame frame;
+        {
+            unique_lock<mutex> hold(recorder->lock);
+            while (recorder->queue.empty() && !recorder->stopping)
+                recorder->wake.wait(hold);
+            if (recorder->queue.empty())
+                return;
+
+            frame.number = recorder->queue.front().number;
+            frame.pixels.swap(recorder->queue.front().pixels);
+            recorder->queue.pop_front();
+        }
+
+        GLboolean written = capture_write(recorder, &frame, row);
+
+        unique_lock<mutex> hold(recorder->lock);
+        if (written)
+            recorder->frames_written += 1;
+        recorder->spare.push_back(vector<GLubyte>());
+        recorder->spare.back().swap(frame.pixels);
+    }
+}
+
+GLboolean capture_start(struct capture *recorder,
+                        GLuint width,
+                        GLuint height,
+                        enum capture_format format,
+                        const char *path) {
+    if (recorder->active)
+        return GL_TRUE;
+
+    recorder->width = width;
+    recorder->height = height;
+    recorder->format = format;
+    recorder->path = path;
+    recorder->raw = NULL;
+
+    if (format == CAPTURE_RAW) {
+        recorder->raw = (strcmp(path, "-") == 0) ? stdout : fopen(path, "wb");
+        if (!recorder->raw) {
+            fprintf(stderr, "Unable to open %s for writing\n", path);
+            return GL_FALSE;
+        }
+    }
+
+    GLsizeiptr frame_bytes = (GLsizeiptr)width * height * 4;
+    glGenBuffers(CAPTURE_RING_SIZE, recorder->pbos);
+    int i;
+    for (i = 0; i < CAPTURE_RING_SIZE; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, recorder->pbos[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frame_bytes, NULL, GL_STREAM_READ);
+        recorder->pbo_pending[i] = GL_FALSE;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    recorder->next_frame = 0;
+    recorder->frames_written = 0;
+    recorder->frames_dropped = 0;
+    recorder->render_thread_ms = 0.0;
+    recorder->stopping = GL_FALSE;
+    recorder->queue.clear();
+    recorder->encoder = thread(capture_encode, recorder);
+    recorder->active = GL_TRUE;
+
+    if (format == CAPTURE_PPM)
+        fprintf(stderr, "Capturing %ux%u frames to %sNNNNN.ppm\n", width, height, path);
+    else
+        fprintf(stderr, "Capturing %ux%u rgb24 frames to %s\n", width, height, path);
+    return GL_TRUE;
+}
+
+/* map a PBO whose read has (almost certainly) completed and queue its
+ * pixels for the encoder, or drop them if the encoder is behind */
+static void capture_collect(struct capture *recorder,
+                            GLuint slot) {
+    if (!recorder->pbo_pending[slot])
+        return;
+    recorder->pbo_pending[slot] = GL_FALSE;
+
+    size_t frame_bytes = (size_t)recorder->width * recorder->height * 4;
+    vector<GLubyte> pixels;
+    {
+        unique_lock<mutex> hold(recorder->lock);
+        if (recorder->queue.size() >= CAPTURE_QUEUE_FRAMES) {
+            recorder->frames_dropped += 1;
+            return;
+        }
+        if (!recorder->spare.empty()) {
+            pixels.swap(recorder->spare.back());
+            recorder->spare.pop_back();
+        }
+    }
+    pixels.resize(frame_bytes);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, recorder->pbos[slot]);
+    void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame_bytes, GL_MAP_READ_BIT);
+    if (!mapped) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        recorder->frames_dropped += 1;
+        return;
+    }
+    memcpy(&pixels[0], mapped, frame_bytes);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    unique_lock<mutex> hold(recorder->lock);
+    recorder->queue.push_back(captured_frame());
+    recorder->queue.back().number = recorder->pbo_frame[slot];
+    recorder->queue.back().pixels.swap(pixels);
+    recorder->wake.notify_one();
+}
+
+/* call once a frame, after rendering and before swapping buffers */
+void capture_frame(struct capture *recorder) {
+    if (!recorder->active)
+        return;
+
+    GLdouble start = glfwGetTime();
+    GLuint slot = recorder->next_frame % CAPTURE_RING_SIZE;
+
+    /* only if the ring wrapped without collecting (doesn't happen in steady state) */
+    capture_collect(recorder, slot);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, recorder->pbos[slot]);
+    glReadPixels(0, 0, recorder->width, recorder->height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    recorder->pbo_frame[slot] = recorder->next_frame;
+    recorder->pbo_pending[slot] = GL_TRUE;
+    recorder->next_frame += 1;
+
+    /* the oldest outstanding read, from CAPTURE_RING_SIZE-1 frames ago */
+    capture_collect(recorder, recorder->next_frame % CAPTURE_RING_SIZE);
+
+    recorder->render_thread_ms += (glfwGetTime() - start) * 1000.0;
+}
+
+/* collect the frames still in flight, wait for the encoder to write
+ * everything and report */
+void capture_stop(struct capture *recorder) {
+    if (!recorder->active)
+        return;
+
+    GLuint i;
+    for (i = 0; i < CAPTURE_RING_SIZE; i++)
+        capture_collect(recorder, (recorder->next_frame + i) % CAPTURE_RING_SIZE);
+
+    {
+        unique_lock<mutex> hold(recorder->lock);
+        recorder->stopping = GL_TRUE;
+        recorder->wake.notify_one();
+    }
+    recorder->encoder.join();
+
+    glDeleteBuffers(CAPTURE_RING_SIZE, recorder->pbos);
+    if (recorder->raw && recorder->raw != stdout)
+        fclose(recorder->raw);
+    else if (recorder->raw)
+        fflush(recorder->raw);
+    recorder->raw = NULL;
+    recorder->spare.clear();
+    recorder->active = GL_FALSE;
+
+    fprintf(stderr, "Captured %u frames: %u written, %u dropped (encoder behind), "
+                    "%.3f ms/frame on the render thread\n",
+            recorder->next_frame, recorder->frames_written, recorder->frames_dropped,
+            recorder->next_frame ? recorder->render_thread_ms / recorder->next_frame : 0.0);
+}
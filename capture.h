@@ -0,0 +1,53 @@
+#define CAPTURE_RING_SIZE 3         /* PBOs; each is mapped CAPTURE_RING_SIZE-1 frames after its read */
+#define CAPTURE_QUEUE_FRAMES 8      /* frames waiting for the encoder before new ones are dropped */
+
+enum capture_format {
+    CAPTURE_PPM,                    /* <prefix>NNNNN.ppm per frame */
+    CAPTURE_RAW                     /* one rgb24 stream, top row first ("-" = stdout) */
+};
+
+/* structure definitions */
+
+struct captured_frame {
+    GLuint number;
+    std::vector<GLubyte> pixels;    /* RGBA, bottom row first (as read back) */
+};
+
+/* records the default framebuffer without stalling: glReadPixels goes into
+ * a ring of pixel buffer objects that are only mapped a couple of frames
+ * later, when the GPU is done with them, and files are written by a
+ * separate encoder thread */
+struct capture {
+    GLboolean active;
+    GLuint width;
+    GLuint height;
+    enum capture_format format;
+    std::string path;
+    FILE *raw;
+
+    GLuint pbos[CAPTURE_RING_SIZE];
+    GLuint pbo_frame[CAPTURE_RING_SIZE];
+    GLboolean pbo_pending[CAPTURE_RING_SIZE];
+    GLuint next_frame;
+
+    /* encoder thread & its queue */
+    std::thread encoder;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<struct captured_frame> queue;
+    std::vector<std::vector<GLubyte> > spare;  /* pixel buffers to reuse */
+    GLboolean stopping;
+
+    GLuint frames_written;
+    GLuint frames_dropped;
+    GLdouble render_thread_ms;      /* total time capture_frame took */
+};
+
+/* function prototypes */
+GLboolean capture_start(struct capture *recorder,
+                        GLuint width,
+                        GLuint height,
+                        enum capture_format format,
+                        const char *path);
+void capture_frame(struct capture *recorder);
+void capture_stop(struct capture *recorder);
@@ -0,0 +1,22 @@
+#version 150
+
+// static lighting, baked per vertex (see bake.cpp): no light loop
+
+struct Material
+{
+    vec3 ambient;
+};
+uniform Material material;
+
+uniform sampler2D tex;
+
+in vec2 out_TexCoord;
+in vec4 out_Baked;
+
+out vec4 fragmentColour;
+
+void main() {
+    vec3 total_lighting = clamp(material.ambient * out_Baked.a + out_Baked.rgb, 0.0, 1.0);
+
+    fragmentColour = texture(tex, out_TexCoord) * vec4(total_lighting, 1.0);
+}
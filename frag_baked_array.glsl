@@ -0,0 +1,25 @@
+#version 150
+
+// static lighting, baked per vertex (see bake.cpp): no light loop.
+// Every model's texture is a layer of one array (see texture_array.cpp);
+// untextured models get a solid white layer
+
+struct Material
+{
+    vec3 ambient;
+};
+uniform Material material;
+
+uniform sampler2DArray tex;
+
+in vec2 out_TexCoord;
+in vec4 out_Baked;
+flat in int out_Layer;
+
+out vec4 fragmentColour;
+
+void main() {
+    vec3 total_lighting = clamp(material.ambient * out_Baked.a + out_Baked.rgb, 0.0, 1.0);
+
+    fragmentColour = texture(tex, vec3(out_TexCoord, out_Layer)) * vec4(total_lighting, 1.0);
+}
@@ -0,0 +1,68 @@
+#version 150
+
+// per-pixel lighting for the heightmap terrain (vert_heightmap.glsl)
+
+struct LightSource
+{
+    vec4 position;
+    vec3 diffuse;
+    vec3 attenuation;  // [x=A, y=B, z=C] -> An^2 + Bn + C
+};
+const int num_lights = 8;
+uniform LightSource light[num_lights];
+
+struct Material
+{
+    vec3 ambient;
+};
+uniform Material material;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform sampler2D tex;
+
+uniform mat3 model_inv;
+
+in vec4 out_Position;
+in vec3 out_Normal;
+in vec2 out_TexCoord;
+
+out vec4 fragmentColour;
+
+void main() {
+    vec3 total_lighting = material.ambient;
+
+    for(int i = 0; i < num_lights; i++) {
+        vec3 normal_direction = normalize(model_inv * out_Normal);
+        vec3 material_diffuse = vec3(1.0, 0.8, 0.8);
+        
+        vec3 light_direction;
+        float attenuation;
+    
+        // OPTIMISATION: remove if branching?
+        // DIRECTIONAL lighting
+        if(light[i].position.w == 0.0) {
+            attenuation = 1.0;
+            light_direction = normalize(vec3(light[i].position));
+        }
+        
+        // POINT/SPOT lighting
+        else {
+            vec3 vertexToSource = vec3(light[i].position - model * out_Position);
+            float dist = length(vertexToSource);
+            
+            attenuation = 1.0 / (light[i].attenuation.x * dist * dist + light[i].attenuation.y * dist + light[i].attenuation.z);
+            light_direction = normalize(vec3(vertexToSource));
+        }
+
+        vec3 diffuse = attenuation 
+                        * light[i].diffuse
+                        * material_diffuse
+                        * max(0.0, dot(normal_direction, light_direction));
+            
+        total_lighting = clamp(total_lighting + diffuse, 0.0, 1.0);
+    }
+    
+    fragmentColour = texture(tex, fract(out_TexCoord)) * vec4(total_lighting, 1.0);   // repeats on large terrains
+}
@@ -0,0 +1,423 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+
+#include "util.h"
+#include "bvh.h"
+#include "heightmap.h"
+
+using namespace std;
+
+/*
+ * Heightmap terrain. The terrain is a regular grid, so storing positions,
+ * normals & texture coordinates per vertex plus an index buffer repeats a
+ * lot of what the grid already implies. Here each sample keeps a 16-bit
+ * height and an 8:8 normal (the y component is implied, since terrain
+ * normals point up), in two textures the vertex shader reads with
+ * texelFetch; x & z come from gl_VertexID within a patch of the grid and
+ * gl_InstanceID picks the patch, so one small index buffer draws any size
+ * of terrain.
+ */
+
+static GLushort heightmap_quantise(GLfloat height,
+                                   GLfloat height_min,
+                                   GLfloat height_scale) {
+    GLfloat t = height_scale > 0.0f ? (height - height_min) / height_scale : 0.0f;
+    t = glm::clamp(t, 0.0f, 1.0f);
+    return (GLushort)(t * 65535.0f + 0.5f);
+}
+
+static GLfloat heightmap_sample(const struct heightmap *map,
+                                GLuint i,
+                                GLuint j) {
+    return map->height_min + map->heights[(size_t)j * map->width + i] * (map->height_scale / 65535.0f);
+}
+
+/* normals from central differences (one-sided at the edges) */
+static void heightmap_compute_normals(struct heightmap *map) {
+    map->normals.resize((size_t)map->width * map->depth * 2);
+
+    GLuint i, j;
+    for (j = 0; j < map->depth; j++) {
+        for (i = 0; i < map->width; i++) {
+            GLuint left = i > 0 ? i - 1 : i, right = i + 1 < map->width ? i + 1 : i;
+            GLuint back = j > 0 ? j - 1 : j, front = j + 1 < map->depth ? j + 1 : j;
+
+            GLfloat dx = (heightmap_sample(map, right, j) - heightmap_sample(map, left, j))
+                         / ((right - left) * map->spacing.x);
+            GLfloat dz = (heightmap_sample(map, i, front) - heightmap_sample(map, i, back))
+                         / ((front - back) * map->spacing.y);
+            glm::vec3 normal = glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+
+            GLubyte *packed = &map->normals[((size_t)j * map->width + i) * 2];
+            packed[0] = (GLubyte)((normal.x * 0.5f + 0.5f) * 255.0f + 0.5f);
+            packed[1] = (GLubyte)((normal.z * 0.5f + 0.5f) * 255.0f + 0.5f);
+        }
+    }
+}
+
+/* solve the 3x3 system m * x = b (Cramer's rule); false if singular */
+static GLboolean heightmap_solve3(const GLdouble m[3][3],
+                                  const GLdouble b[3],
+                                  GLdouble x[3]) {
+    GLdouble det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                 - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                 + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if (fabs(det) < 1e-12)
+        return GL_FALSE;
+
+    int column;
+    for (column = 0; column < 3; column++) {
+        GLdouble replaced[3][3];
+        int r, c;
+        for (r = 0; r < 3; r++)
+            for (c = 0; c < 3; c++)
+                replaced[r][c] = (c == column) ? b[r] : m[r][c];
+        x[column] = (replaced[0][0] * (replaced[1][1] * replaced[2][2] - replaced[1][2] * replaced[2][1])
+                   - replaced[0][1] * (replaced[1][0] * replaced[2][2] - replaced[1][2] * replaced[2][0])
+                   + replaced[0][2] * (replaced[1][0] * replaced[2][1] - replaced[1][1] * replaced[2][0])) / det;
+    }
+    return GL_TRUE;
+}
+
+/* texture coordinates as an affine function of model-space (x, z),
+ * least-squares fitted to the mesh's own (the terrain's uv mapping is a
+ * planar projection) */
+static glm::mat3 heightmap_fit_tex_transform(const struct mesh_data *mesh) {
+    GLdouble normal_matrix[3][3] = { { 0.0 } };
+    GLdouble u_sum[3] = { 0.0 }, v_sum[3] = { 0.0 };
+
+    size_t i;
+    for (i = 0; i < mesh->vertices.size() && i < mesh->tex_coords.size(); i++) {
+        GLdouble p[3] = { mesh->vertices[i].x, mesh->vertices[i].z, 1.0 };
+        int r, c;
+        for (r = 0; r < 3; r++) {
+            for (c = 0; c < 3; c++)
+                normal_matrix[r][c] += p[r] * p[c];
+            u_sum[r] += p[r] * mesh->tex_coords[i].x;
+            v_sum[r] += p[r] * mesh->tex_coords[i].y;
+        }
+    }
+
+    GLdouble u[3], v[3];
+    if (!heightmap_solve3(normal_matrix, u_sum, u) || !heightmap_solve3(normal_matrix, v_sum, v))
+        return glm::mat3(1.0f);
+
+    /* uv = (tex_transform * vec3(x, z, 1)).xy */
+    return glm::mat3(glm::vec3(u[0], v[0], 0.0f),
+                     glm::vec3(u[1], v[1], 0.0f),
+                     glm::vec3(u[2], v[2], 1.0f));
+}
+
+/* sample a mesh's surface on a width x depth grid over its bounds; grid
+ * points the mesh doesn't cover get its lowest height */
+void heightmap_from_mesh(struct heightmap *map,
+                         const struct mesh_data *mesh,
+                         const struct bvh *tree,
+                         GLuint width,
+                         GLuint depth) {
+    glm::vec3 bounds_min = tree->nodes[0].bounds_min, bounds_max = tree->nodes[0].bounds_max;
+
+    map->width = width;
+    map->depth = depth;
+    map->origin = glm::vec2(bounds_min.x, bounds_min.z);
+    map->spacing = glm::vec2((bounds_max.x - bounds_min.x) / (width - 1),
+                             (bounds_max.z - bounds_min.z) / (depth - 1));
+    map->height_min = bounds_min.y;
+    map->height_scale = bounds_max.y - bounds_min.y;
+    map->tex_transform = heightmap_fit_tex_transform(mesh);
+
+    vector<glm::vec2> points((size_t)width * depth);
+    vector<GLfloat> heights(points.size());
+    GLuint i, j;
+    for (j = 0; j < depth; j++)
+        for (i = 0; i < width; i++)
+            points[(size_t)j * width + i] = map->origin + glm::vec2(i, j) * map->spacing;
+    bvh_heights_at(tree, &points[0], &heights[0], (GLuint)points.size(), bounds_min.y);
+
+    map->heights.resize(points.size());
+    size_t k;
+    for (k = 0; k < heights.size(); k++)
+        map->heights[k] = heightmap_quantise(heights[k], map->height_min, map->height_scale);
+
+    heightmap_compute_normals(map);
+}
+
+/* a square raw height image: 16-bit little-endian samples, row by row,
+ * spacing world units apart & centred on the origin, with 65535 at
+ * height_scale. The side is worked out from the file size */
+GLboolean heightmap_load_raw(struct heightmap *map,
+                             const char *path,
+                             GLfloat spacing,
+                             GLfloat height_scale) {
+    /* read in chunks rather than with file_contents, whose GLint length
+     * stops at 2 GB (a 32768^2 image) */
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return GL_FALSE;
+    }
+    off_t length = -1;
+    if (fseeko(f, 0, SEEK_END) == 0)
+        length = ftello(f);
+    fseeko(f, 0, SEEK_SET);
+
+    size_t side = (size_t)(sqrt(length / 2.0) + 0.5);
+    if (length < 0 || side < 2 || (off_t)(side * side * 2) != length) {
+        fprintf(stderr, "%s: %lld bytes isn't a square image of 16-bit heights\n", path, (long long)length);
+        fclose(f);
+        return GL_FALSE;
+    }
+
+    map->width = map->depth = side;
+    map->origin = glm::vec2(-0.5f * spacing * (side - 1));
+    map->spacing = glm::vec2(spacing);
+    map->height_min = 0.0f;
+    map->height_scale = height_scale;
+
+    /* the texture repeats (in the fragment shader) every TEXTURE_SPAN units */
+    map->tex_transform = glm::mat3(glm::vec3(1.0f / HEIGHTMAP_RAW_TEXTURE_SPAN, 0.0f, 0.0f),
+                                   glm::vec3(0.0f, 1.0f / HEIGHTMAP_RAW_TEXTURE_SPAN, 0.0f),
+                                   glm::vec3(0.5f, 0.5f, 1.0f));
+
+    map->heights.resize(side * side);
+    vector<GLubyte> bytes(HEIGHTMAP_READ_CHUNK * 2);
+    size_t done = 0, k;
+    while (done < map->heights.size()) {
+        size_t count = min(map->heights.size() - done, (size_t)HEIGHTMAP_READ_CHUNK);
+        if (fread(&bytes[0], 2, count, f) != count) {
+            fprintf(stderr, "%s: read error\n", path);
+            fclose(f);
+            return GL_FALSE;
+        }
+        for (k = 0; k < count; k++)
+            map->heights[done + k] = (GLushort)(bytes[k*2] | (bytes[k*2+1] << 8));
+        done += count;
+    }
+    fclose(f);
+
+    heightmap_compute_normals(map);
+    return GL_TRUE;
+}
+
+/* height at (fx, fz) within a grid quad with corner heights a = (0, 0),
+ * b = (1, 0), c = (0, 1) & d = (1, 1), on the triangles the grid is drawn
+ * with (split along the a-d diagonal) */
+GLfloat heightmap_interpolate(GLfloat a,
+                              GLfloat b,
+                              GLfloat c,
+                              GLfloat d,
+                              GLfloat fx,
+                              GLfloat fz) {
+    if (fx >= fz)
+        return a + fx * (b - a) + fz * (d - b);
+    return a + fz * (c - a) + fx * (d - c);
+}
+
+/* height at model-space (x, z) */
+GLboolean heightmap_height_at(const struct heightmap *map,
+                              GLfloat x,
+                              GLfloat z,
+                              GLfloat *height) {
+    GLfloat gx = (x - map->origin.x) / map->spacing.x;
+    GLfloat gz = (z - map->origin.y) / map->spacing.y;
+    if (!(gx >= 0.0f && gz >= 0.0f && gx <= map->width - 1 && gz <= map->depth - 1))
+        return GL_FALSE;
+
+    GLuint i = min((GLuint)gx, map->width - 2), j = min((GLuint)gz, map->depth - 2);
+    GLfloat fx = gx - i, fz = gz - j;
+
+    *height = heightmap_interpolate(heightmap_sample(map, i, j), heightmap_sample(map, i + 1, j),
+                                    heightmap_sample(map, i, j + 1), heightmap_sample(map, i + 1, j + 1),
+                                    fx, fz);
+    return GL_TRUE;
+}
+
+static GLboolean heightmap_surface_height(const void *surface,
+                                          GLfloat x,
+                                          GLfloat z,
+                                          GLfloat *height) {
+    return heightmap_height_at((const struct heightmap*)surface, x, z, height);
+}
+
+/* first point where a model-space ray goes from above a height field to
+ * below it: march in half-sample steps, then bisect */
+GLboolean heightmap_march_ray(heightmap_height_fn height_at,
+                              const void *surface,
+                              GLfloat spacing,
+                              glm::vec3 origin,
+                              glm::vec3 direction,
+                              GLfloat max_distance,
+                              glm::vec3 *hit) {
+    GLfloat length = glm::length(direction);
+    if (length == 0.0f)
+        return GL_FALSE;
+
+    GLfloat step = 0.5f * spacing / length;
+    GLfloat last_t = 0.0f, t;
+    GLboolean last_above = GL_FALSE;
+
+    for (t = 0.0f; t <= max_distance; t += step) {
+        glm::vec3 point = origin + direction * t;
+        GLfloat ground;
+        if (!height_at(surface, point.x, point.z, &ground)) {
+            last_above = GL_FALSE;
+            continue;
+        }
+
+        GLboolean above = point.y >= ground;
+        if (!above && last_above) {
+            GLfloat low = last_t, high = t;
+            int i;
+            for (i = 0; i < 16; i++) {
+                GLfloat mid = 0.5f * (low + high);
+                glm::vec3 p = origin + direction * mid;
+                if (height_at(surface, p.x, p.z, &ground) && p.y >= ground)
+                    low = mid;
+                else
+                    high = mid;
+            }
+            *hit = origin + direction * high;
+            return GL_TRUE;
+        }
+        last_above = above;
+        last_t = t;
+    }
+    return GL_FALSE;
+}
+
+GLboolean heightmap_intersect_ray(const struct heightmap *map,
+                                  glm::vec3 origin,
+                                  glm::vec3 direction,
+                                  GLfloat max_distance,
+                                  glm::vec3 *hit) {
+    return heightmap_march_ray(heightmap_surface_height, map, min(map->spacing.x, map->spacing.y),
+                               origin, direction, max_distance, hit);
+}
+
+/* CPU copy (the textures take the same again on the GPU) */
+size_t heightmap_bytes(const struct heightmap *map) {
+    return map->heights.size() * sizeof(GLushort) + map->normals.size() * sizeof(GLubyte);
+}
+
+/* VAO with no attributes & the index buffer of one patch of
+ * (PATCH_QUADS+1)^2 vertices, indexed by gl_VertexID */
+void heightmap_make_patch(GLuint *vao,
+                          GLuint *elements,
+                          GLuint *num_elements) {
+    vector<GLushort> indices;
+    const GLuint row = HEIGHTMAP_PATCH_QUADS + 1;
+    GLuint i, j;
+    for (j = 0; j < HEIGHTMAP_PATCH_QUADS; j++) {
+        for (i = 0; i < HEIGHTMAP_PATCH_QUADS; i++) {
+            GLushort a = (GLushort)(j * row + i), b = a + 1;
+            GLushort c = (GLushort)(a + row), d = c + 1;
+            indices.push_back(a); indices.push_back(c); indices.push_back(d);
+            indices.push_back(a); indices.push_back(d); indices.push_back(b);
+        }
+    }
+    *num_elements = (GLuint)indices.size();
+
+    glGenVertexArrays(1, vao);
+    glBindVertexArray(*vao);
+    *elements = make_buffer(GL_ELEMENT_ARRAY_BUFFER, &indices[0],
+                            indices.size() * sizeof(GLushort));
+    glBindVertexArray(0);
+}
+
+/* textures & the patch index buffer; needs a GL context. GL_FALSE (with
+ * nothing made) if the heightmap is larger than a texture can be, when it
+ * has to be streamed instead */
+GLboolean heightmap_upload(struct heightmap *map) {
+    GLint max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (map->width > (GLuint)max_size || map->depth > (GLuint)max_size) {
+        fprintf(stderr, "Heightmap of %ux%u samples is over GL_MAX_TEXTURE_SIZE (%d); split it with "
+                        "--heightmap file.r16 --make-tiles out.tiles and run with --stream out.tiles\n",
+                map->width, map->depth, max_size);
+        return GL_FALSE;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glGenTextures(1, &map->height_texture);
+    glBindTexture(GL_TEXTURE_2D, map->height_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, map->width, map->depth, 0,
+                 GL_RED, GL_UNSIGNED_SHORT, &map->heights[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &map->normal_texture);
+    glBindTexture(GL_TEXTURE_2D, map->normal_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, map->width, map->depth, 0,
+                 GL_RG, GL_UNSIGNED_BYTE, &map->normals[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    heightmap_make_patch(&map->vao, &map->patch_elements, &map->num_patch_elements);
+    map->program = 0;
+    return GL_TRUE;
+}
+
+static void heightmap_find_uniforms(struct heightmap *map,
+                                    GLuint program) {
+    map->program = program;
+    map->uniforms.heights = glGetUniformLocation(program, "heights");
+    map->uniforms.normals = glGetUniformLocation(program, "normals");
+    map->uniforms.samples = glGetUniformLocation(program, "samples");
+    map->uniforms.patches_x = glGetUniformLocation(program, "patches_x");
+    map->uniforms.origin = glGetUniformLocation(program, "origin");
+    map->uniforms.spacing = glGetUniformLocation(program, "spacing");
+    map->uniforms.height_range = glGetUniformLocation(program, "height_range");
+    map->uniforms.tex_transform = glGetUniformLocation(program, "tex_transform");
+}
+
+/* draw the whole grid as instanced patches, with the program (and its
+ * camera, light & model uniforms) already bound */
+void heightmap_draw(struct heightmap *map,
+                    GLuint program) {
+    if (map->program != program)
+        heightmap_find_uniforms(map, program);
+
+    GLuint patches_x = (map->width - 2) / HEIGHTMAP_PATCH_QUADS + 1;
+    GLuint patches_z = (map->depth - 2) / HEIGHTMAP_PATCH_QUADS + 1;
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, map->height_texture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, map->normal_texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform1i(map->uniforms.heights, 1);
+    glUniform1i(map->uniforms.normals, 2);
+    glUniform2i(map->uniforms.samples, map->width, map->depth);
+    glUniform1i(map->uniforms.patches_x, patches_x);
+    glUniform2fv(map->uniforms.origin, 1, glm::value_ptr(map->origin));
+    glUniform2fv(map->uniforms.spacing, 1, glm::value_ptr(map->spacing));
+    glUniform2f(map->uniforms.height_range, map->height_min, map->height_scale);
+    glUniformMatrix3fv(map->uniforms.tex_transform, 1, GL_FALSE, glm::value_ptr(map->tex_transform));
+
+    glBindVertexArray(map->vao);
+    glDrawElementsInstanced(GL_TRIANGLES, map->num_patch_elements, GL_UNSIGNED_SHORT,
+                            (void*)0, patches_x * patches_z);
+    glBindVertexArray(0);
+}
+
+void heightmap_release(struct heightmap *map) {
+    glDeleteTextures(1, &map->height_texture);
+    glDeleteTextures(1, &map->normal_texture);
+    glDeleteBuffers(1, &map->patch_elements);
+    glDeleteVertexArrays(1, &map->vao);
+
+    map->height_texture = map->normal_texture = map->patch_elements = map->vao = 0;
+    map->program = 0;
+}
@@ -0,0 +1,90 @@
+#define HEIGHTMAP_CONVERT_SIZE 128      /* samples per side when converting a mesh */
+#define HEIGHTMAP_PATCH_QUADS 64        /* grid patch drawn per instance; PATCH_QUADS in vert_heightmap.glsl */
+#define HEIGHTMAP_RAW_SPACING (20.0 / 256)  /* world units between raw image samples */
+#define HEIGHTMAP_RAW_TEXTURE_SPAN 20.0 /* the terrain texture repeats this often on raw heightmaps */
+#define HEIGHTMAP_RAW_HEIGHT 2.0        /* world height of the raw value 65535 */
+#define HEIGHTMAP_READ_CHUNK 65536      /* samples decoded per read of a raw image */
+
+/* height of some height field at model-space (x, z), false outside it */
+typedef GLboolean (*heightmap_height_fn)(const void *surface, GLfloat x, GLfloat z, GLfloat *height);
+
+/* structure definitions */
+
+/* terrain as a regular grid of heights: 2 bytes of height and 2 of normal
+ * per sample, instead of a full vertex (position, normal, uv) + indices.
+ * Sample (i, j) is at model-space (origin.x + i*spacing.x, origin.y + j*spacing.y) */
+struct heightmap {
+    GLuint width;                   /* samples along x */
+    GLuint depth;                   /* samples along z */
+    glm::vec2 origin;
+    glm::vec2 spacing;
+    GLfloat height_min;             /* height = height_min + sample / 65535 * height_scale */
+    GLfloat height_scale;
+    glm::mat3 tex_transform;        /* uv = (tex_transform * vec3(x, z, 1)).xy */
+
+    std::vector<GLushort> heights;  /* row-major, z rows */
+    std::vector<GLubyte> normals;   /* normal.x, normal.z as unsigned bytes; y is reconstructed */
+
+    /* GL objects (heightmap_upload) */
+    GLuint height_texture;          /* GL_R16 */
+    GLuint normal_texture;          /* GL_RG8 */
+    GLuint vao;                     /* no attributes, just the patch index buffer */
+    GLuint patch_elements;
+    GLuint num_patch_elements;
+
+    GLuint program;                 /* program the uniforms below belong to */
+    struct {
+        GLint heights;
+        GLint normals;
+        GLint samples;
+        GLint patches_x;
+        GLint origin;
+        GLint spacing;
+        GLint height_range;
+        GLint tex_transform;
+    } uniforms;
+};
+
+/* function prototypes */
+void heightmap_from_mesh(struct heightmap *map,
+                         const struct mesh_data *mesh,
+                         const struct bvh *tree,
+                         GLuint width,
+                         GLuint depth);
+GLboolean heightmap_load_raw(struct heightmap *map,
+                             const char *path,
+                             GLfloat spacing,
+                             GLfloat height_scale);
+
+GLfloat heightmap_interpolate(GLfloat a,
+                              GLfloat b,
+                              GLfloat c,
+                              GLfloat d,
+                              GLfloat fx,
+                              GLfloat fz);
+GLboolean heightmap_height_at(const struct heightmap *map,
+                              GLfloat x,
+                              GLfloat z,
+                              GLfloat *height);
+GLboolean heightmap_march_ray(heightmap_height_fn height_at,
+                              const void *surface,
+                              GLfloat spacing,
+                              glm::vec3 origin,
+                              glm::vec3 direction,
+                              GLfloat max_distance,
+                              glm::vec3 *hit);
+GLboolean heightmap_intersect_ray(const struct heightmap *map,
+                                  glm::vec3 origin,
+                                  glm::vec3 direction,
+                                  GLfloat max_distance,
+                                  glm::vec3 *hit);
+
+size_t heightmap_bytes(const struct heightmap *map);
+
+void heightmap_make_patch(GLuint *vao,
+                          GLuint *elements,
+                          GLuint *num_elements);
+GLboolean heightmap_upload(struct heightmap *map);
+void heightmap_draw(struct heightmap *map,
+                    GLuint program);
+void heightmap_release(struct heightmap *map);
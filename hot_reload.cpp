@@ -0,0 +1,121 @@
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <GL/glfw.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh_arena.h"
+#include "texture_array.h"
+#include "resources.h"
+#include "hot_reload.h"
+
+using namespace std;
+
+/*
+ * Incremental asset reloading: only resources whose source file changed are
+ * re-created (plus programs linked from a changed shader).
+ */
+
+#define HOT_RELOAD_EVENT_BUFFER 4096
+
+/* start watching `directory` (where the assets are loaded from) */
+GLboolean hot_reload_init(struct hot_reload *watcher,
+                          const char *directory) {
+    watcher->fd = -1;
+    watcher->watch = -1;
+    watcher->last_reload_ms = 0.0;
+
+#ifdef __linux__
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->fd < 0) {
+        perror("inotify_init1");
+        return GL_FALSE;
+    }
+
+    /* editors often write a temporary file and rename it over the original,
+     * so watch the directory for both completed writes and moves */
+    watcher->watch = inotify_add_watch(watcher->fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watcher->watch < 0) {
+        perror("inotify_add_watch");
+        close(watcher->fd);
+        watcher->fd = -1;
+        return GL_FALSE;
+    }
+
+    return GL_TRUE;
+#else
+    fprintf(stderr, "Hot reload is only supported on Linux\n");
+    return GL_FALSE;
+#endif
+}
+
+/* drain pending change events and reload the affected resources; returns
+ * the number of resources replaced (0 if nothing changed or all failed) */
+GLuint hot_reload_poll(struct hot_reload *watcher,
+                       struct resource_manager *manager) {
+    if (watcher->fd < 0)
+        return 0;
+
+#ifdef __linux__
+    /* collect each changed file once, however many events it produced */
+    set<string> changed;
+    char buffer[HOT_RELOAD_EVENT_BUFFER]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t length = read(watcher->fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            if (length < 0 && errno != EAGAIN)
+                perror("inotify read");
+            break;
+        }
+
+        char *ptr = buffer;
+        while (ptr < buffer + length) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            if (event->len > 0)
+                changed.insert(event->name);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if (changed.empty())
+        return 0;
+
+    GLdouble start = glfwGetTime();
+    GLuint reloaded = 0;
+    set<string>::iterator it;
+    for (it = changed.begin(); it != changed.end(); ++it)
+        reloaded += resource_reload_path(manager, it->c_str());
+
+    if (reloaded > 0) {
+        watcher->last_reload_ms = (glfwGetTime() - start) * 1000.0;
+        fprintf(stderr, "Reloaded %u resources in %.2f ms\n", reloaded, watcher->last_reload_ms);
+    }
+
+    return reloaded;
+#else
+    return 0;
+#endif
+}
+
+void hot_reload_close(struct hot_reload *watcher) {
+    if (watcher->fd >= 0)
+        close(watcher->fd);
+
+    watcher->fd = -1;
+    watcher->watch = -1;
+}
@@ -0,0 +1,17 @@
+/* structure definitions */
+
+/* watches the asset directory for changed files (inotify, Linux only; a
+ * no-op elsewhere). Changes are only acted on in hot_reload_poll, which the
+ * main loop calls between frames, so a frame never sees a half-swapped set */
+struct hot_reload {
+    int fd;             /* inotify instance, -1 if unavailable */
+    int watch;
+    GLdouble last_reload_ms;
+};
+
+/* function prototypes */
+GLboolean hot_reload_init(struct hot_reload *watcher,
+                          const char *directory);
+GLuint hot_reload_poll(struct hot_reload *watcher,
+                       struct resource_manager *manager);
+void hot_reload_close(struct hot_reload *watcher);
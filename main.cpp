@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <GL/glew.h>
 #include <GL/glfw.h>
@@ -9,20 +10,77 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 using namespace std;
 
 #include "util.h"
+#include "camera.h"
+#include "bvh.h"
+#include "scene_store.h"
+#include "mesh_arena.h"
+#include "texture_array.h"
+#include "resources.h"
+#include "hot_reload.h"
+#include "thread_pool.h"
+#include "bake.h"
+#include "softrast.h"
+#include "capture.h"
+#include "resolution.h"
+#include "heightmap.h"
+#include "tile_stream.h"
 
 /* definition macros */
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 600
+#define FSAA_SAMPLES 4
+#define CAMERA_GROUND_CLEARANCE 0.1
+#define PICK_DISTANCE 50.0
+#define SOFTWARE_FRAME_TIME (1.0 / 30.0)   /* fixed tour step when rendering without a GPU */
 
 
 /* global variables */
 
 static struct model terrain;
 static struct model base;
+static struct mesh_data terrain_mesh;   /* parsed once, for everything that needs */
+static struct mesh_data base_mesh;      /* the geometry (see load_scene_meshes) */
+
+static struct bvh terrain_bvh;
+static struct heightmap terrain_heightmap;
+static GLboolean heightmap_terrain;    /* draw the terrain from terrain_heightmap */
+static const char *heightmap_path;      /* raw 16-bit heights; NULL converts terrain_tex.obj */
+static struct tile_stream terrain_tiles;
+static const char *tiles_path;          /* stream the terrain from this tile file */
+static GLuint tiles_budget_mb = TILE_STREAM_BUDGET_MB;
+static struct earthquake terrain_quake;
+
+static struct scene_store scene_objects;
+
+static struct resource_manager gpu_resources;
+static struct hot_reload asset_watcher;
+
+static struct thread_pool workers;
+static struct bake_task scene_bake;     /* the background lighting bake (see bake_scene) */
+static GLboolean rebake_pending;        /* the scene changed while it ran */
+static vector<glm::vec4> terrain_baked; /* the bakes on screen, for a mesh */
+static vector<glm::vec4> base_baked;    /* reload to show until it's rebaked */
+
+static struct capture recorder;
+static enum capture_format capture_format = CAPTURE_PPM;
+static const char *capture_path = "capture_";
+static GLboolean capture_tour;      /* record the tour from start to end, then stop */
+
+static struct resolution_scaler scaler;
+static GLboolean fixed_resolution;  /* draw straight to the window, at full size */
 
 static struct scene main_scene;
 static struct camera main_camera;
@@ -31,6 +89,39 @@ static GLdouble last_known_time;
 
 static GLboolean free_roam_mode;
 
+static GLboolean dynamic_lighting;  /* per-pixel light loop instead of baked lighting */
+static GLboolean texture_arrays_off;    /* baked: a 2D texture per model, not a shared array */
+
+/* what the last frame cost in state changes (reported with R) */
+static GLuint frame_passes, last_frame_passes;
+static GLuint frame_texture_binds, last_frame_texture_binds;
+static GLuint bound_texture;    /* on unit 0; reset each frame, as other code binds there too */
+
+/* height of the terrain surface at world (x, z), following the terrain's position */
+static GLboolean terrain_height_at(GLfloat x, GLfloat z, GLfloat *height) {
+    glm::vec3 terrain_position = scene_objects.positions[terrain.entity];
+    GLboolean found;
+    if (terrain_tiles.mapped)
+        found = tile_stream_height_at(&terrain_tiles, x - terrain_position.x, z - terrain_position.z, height);
+    else if (heightmap_terrain)
+        found = heightmap_height_at(&terrain_heightmap, x - terrain_position.x, z - terrain_position.z, height);
+    else
+        found = bvh_height_at(&terrain_bvh, x - terrain_position.x, z - terrain_position.z, height);
+    if (!found)
+        return GL_FALSE;
+    
+    *height += terrain_position.y;
+    return GL_TRUE;
+}
+
+/* keep the camera from passing through the terrain */
+static void camera_clamp_to_ground() {
+    GLfloat ground;
+    if (terrain_height_at(main_camera.position.x, main_camera.position.z, &ground)
+        && main_camera.position.y < ground + CAMERA_GROUND_CLEARANCE)
+        main_camera.position.y = ground + CAMERA_GROUND_CLEARANCE;
+}
+
 /* horizontally rotate the camera (around its up vector)
  *  +ve turns left from eye perspective, i.e. anticlockwise from above */
 static void camera_rotate(GLfloat angle_x, GLfloat angle_y) {
@@ -41,6 +132,9 @@ static void camera_rotate(GLfloat angle_x, GLfloat angle_y) {
 static void camera_translate(glm::vec3 direction, GLfloat magnitude) {
     glm::vec3 vector = direction * magnitude;
     main_camera.position += vector;
+    
+    if (free_roam_mode)
+        camera_clamp_to_ground();
 }
 
 static void camera_move(GLfloat forwards_mag, GLfloat right_mag) {
@@ -55,41 +149,8 @@ static void camera_move(GLfloat forwards_mag, GLfloat right_mag) {
     camera_translate(right_dir, right_mag);
 }
 
-/* add a stage to the camera's tour */
-static void camera_add_stage(glm::vec3 to_point,
-                             GLfloat to_angle,
-                             GLfloat duration) {
-    int i = main_camera.num_stages;
-    if (i < MAX_CAMERA_ACTIONS) {
-        if (i == 0) {/* first: start is initial camera position */
-            main_camera.tour[i].start = main_camera.position;
-            main_camera.tour[i].start_angle = main_camera.angles.x;
-        }
-        else { /* o/w, use end of previous camera action */
-            main_camera.tour[i].start = main_camera.tour[i-1].end;
-            main_camera.tour[i].start_angle = main_camera.tour[i-1].end_angle;
-        }
-        
-        main_camera.tour[i].end = to_point;
-        main_camera.tour[i].end_angle = to_angle;
-        main_camera.tour[i].duration = duration;
-        
-        main_camera.num_stages += 1;
-    }
-    else {
-        printf("Too many camera actions");
-    }
-}
-
 static void camera_recalculate_view_matrix() {
-        glm::vec3 lookat;
-        lookat.x = sinf(main_camera.angles.x) * cosf(main_camera.angles.y);
-        lookat.y = sinf(main_camera.angles.y);
-        lookat.z = cosf(main_camera.angles.x) * cosf(main_camera.angles.y);
-    
-        main_scene.view_matrix = glm::lookAt(main_camera.position,
-                                             main_camera.position + lookat,
-                                             main_camera.up);
+        main_scene.view_matrix = camera_view_matrix(&main_camera);
 }
 
 /* populate fields of main_camera's initial position */
@@ -108,58 +169,72 @@ static void camera_make(glm::vec3 position,
                                                     20.0f);
 }
 
-/* change the rate of the camera motion (compared to how it was programmed)... but not < 0 */
-static void camera_rate(GLfloat delta) {
-    printf("%f\n", main_camera.rate);
-    if (main_camera.rate + delta <= 0.2) {
-        return;
-    }
-    
-    main_camera.rate += delta;
-    
-    int i;
-    for (i = 0; i < main_camera.num_stages; i++) {
-        main_camera.tour[i].duration /= main_camera.rate;
-        main_camera.tour[i].time_elapsed /= main_camera.rate;        
-    }
-}
-
 /* set details about the material of a model (i.e. ambient light level */
 static void model_set_material(struct model *model,
                                 glm::vec3 ambient) {
-    model->uniforms.ambient = glGetUniformLocation(model->program, "material.ambient");
     model->material.ambient = ambient;
 }
 
 /* set the position in world space of a model */
 static void model_set_location(struct model *model,
                                 glm::vec3 position) {
-    model->position = position;
+    scene_store_set_position(&scene_objects, model->entity, position);
 }
 
-/* draw a model to the screen */
-static void model_render(struct model *obj_model) {
-    glUseProgram(obj_model->program);
+/* current (local) position of a model */
+static glm::vec3 model_location(struct model *model) {
+    return scene_objects.positions[model->entity];
+}
+
+/* place a model on the terrain surface at world (x, z) */
+static void model_drop_to_ground(struct model *model,
+                                 GLfloat x,
+                                 GLfloat z) {
+    GLfloat ground;
+    if (!terrain_height_at(x, z, &ground))
+        ground = model_location(&terrain).y;
+    
+    model_set_location(model, glm::vec3(x, ground, z));
+}
+
+/* drop a model wherever the camera is looking, if that's on the terrain */
+static void model_drop_at_lookat(struct model *model) {
+    struct bvh_hit hit;
+    glm::vec3 terrain_position = model_location(&terrain);
+    glm::vec3 origin = main_camera.position - terrain_position;
     
-    /* texture stuff */
-    if (terrain.texture) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, terrain.texture);
-        glUniform1i(terrain.uniforms.texture, /*GL_TEXTURE*/0);
+    if (terrain_tiles.mapped) {
+        if (tile_stream_intersect_ray(&terrain_tiles, origin, camera_lookat_direction(&main_camera), PICK_DISTANCE, &hit.position))
+            model_drop_to_ground(model, hit.position.x + terrain_position.x, hit.position.z + terrain_position.z);
+        return;
     }
     
-    /* mvp matrix uniform */
-    glm::mat4 model_mat = glm::translate(glm::mat4(1.0), obj_model->position);
-    glm::mat3 model_inv = glm::transpose(glm::inverse(glm::mat3(model_mat)));
+    if (heightmap_terrain) {
+        if (heightmap_intersect_ray(&terrain_heightmap, origin, camera_lookat_direction(&main_camera), PICK_DISTANCE, &hit.position))
+            model_drop_to_ground(model, hit.position.x + terrain_position.x, hit.position.z + terrain_position.z);
+        return;
+    }
     
-    glUniformMatrix4fv(obj_model->uniforms.model,
-                       1,
-                       GL_FALSE,
-                       glm::value_ptr(model_mat));
-    glUniformMatrix3fv(obj_model->uniforms.model_inv,
-                       1,
-                       GL_FALSE,
-                       glm::value_ptr(model_inv));
+    if (bvh_intersect_ray(&terrain_bvh, origin, camera_lookat_direction(&main_camera), PICK_DISTANCE, &hit))
+        model_drop_to_ground(model, hit.position.x + terrain_position.x, hit.position.z + terrain_position.z);
+}
+
+/* set up everything models sharing a pass have in common: program,
+ * texture, camera, lights & material */
+static void model_bind(struct model *obj_model) {
+    glUseProgram(obj_model->program);
+    frame_passes += 1;
+    
+    /* texture stuff: passes sharing a texture (array) only bind it once */
+    if (obj_model->texture) {
+        if (obj_model->texture != bound_texture) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(obj_model->texture_target, obj_model->texture);
+            bound_texture = obj_model->texture;
+            frame_texture_binds += 1;
+        }
+        glUniform1i(obj_model->uniforms.texture, /*GL_TEXTURE*/0);
+    }
     
     glUniformMatrix4fv(obj_model->uniforms.view,
                        1,
@@ -186,16 +261,54 @@ static void model_render(struct model *obj_model) {
     
     /* material uniforms */
     glUniform3fv(obj_model->uniforms.ambient, 1, glm::value_ptr(obj_model->material.ambient));
+}
+
+/* draw models that share a pass, up to batch_size of them per draw call */
+static void model_render_pass(struct model **models, GLuint count) {
+    model_bind(models[0]);
+    
+    GLuint batch_size = (GLuint)min(models[0]->batch_size, ARENA_MAX_DRAWS);
+    glm::mat4 model_matrices[ARENA_MAX_DRAWS];
+    glm::mat3 normal_matrices[ARENA_MAX_DRAWS];
+    GLint layers[ARENA_MAX_DRAWS];
     
-    /* draw elements */
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj_model->element_buffer);
-    glDrawElements(
-                   GL_TRIANGLES,       /* drawing mode */
-                   (GLuint)obj_model->num_drawn_vertices,      /* count */
-                   GL_UNSIGNED_SHORT,       /* type */
-                   (void*)0                 /* element array buffer offset */
-                   );
+    GLuint first, i;
+    for (first = 0; first < count; first += batch_size) {
+        GLuint batch = min(batch_size, count - first);
+        
+        model_batch_uniforms(&scene_objects, models + first, batch,
+                             model_matrices, normal_matrices, layers);
+        for (i = 0; i < batch; i++) {
+            struct model *obj_model = models[first + i];
+            mesh_arena_draw(&gpu_resources.arena,
+                            obj_model->first_index,
+                            (GLuint)obj_model->num_drawn_vertices,
+                            obj_model->first_vertex);
+        }
+        
+        glUniformMatrix4fv(models[0]->uniforms.model,
+                           batch,
+                           GL_FALSE,
+                           glm::value_ptr(model_matrices[0]));
+        glUniformMatrix3fv(models[0]->uniforms.model_inv,
+                           batch,
+                           GL_FALSE,
+                           glm::value_ptr(normal_matrices[0]));
+        glUniform1iv(models[0]->uniforms.layer, batch, layers);
+        
+        mesh_arena_submit(&gpu_resources.arena);
+    }
+}
+
+/* draw models to the screen, one pass per program/texture/material */
+static void model_render(struct model **models, GLuint count) {
+    model_sort_passes(models, count);
     
+    GLuint first, end;
+    for (first = 0; first < count; first = end) {
+        end = model_pass_end(models, first, count);
+        model_render_pass(models + first, end - first);
+    }
 }
 
 /* let there be (a) light */
@@ -214,45 +327,109 @@ static void light_make(glm::vec4 position,
     }
 }
 
-/* camera movement handler; called on every "tick" of the timer */
-static void timer_camera(GLdouble delta) {
-    if(main_camera.stopped) {
-        camera_recalculate_view_matrix();
+/* bake static lighting for the terrain & base into a vertex attribute, or
+ * load it from the cache if nothing it depends on has changed. Runs in the
+ * background: the current bake stays on screen until bake_scene_collect
+ * swaps the new one in. Asked again while baking, it bakes once more after */
+static void bake_scene() {
+    if (dynamic_lighting)
         return;
-    }
     
-    // if this stage has finished
-    if (main_camera.tour[main_camera.current_stage].time_elapsed
-        > main_camera.tour[main_camera.current_stage].duration) {
-        
-        // place it at the end point (otherwise it may overshoot)
-        main_camera.position = main_camera.tour[main_camera.current_stage].end;
-        
-        if (main_camera.current_stage == main_camera.num_stages - 1) {
-            // if it's the last stage
-            main_camera.stopped = GL_TRUE;
-            return;
-        }
-        else {
-            // otherwise, progress to next stage
-            main_camera.current_stage += 1;
-        }
+    if (scene_bake.running) {
+        rebake_pending = GL_TRUE;
+        return;
     }
+    rebake_pending = GL_FALSE;
+    
+    scene_store_update(&scene_objects);
+    
+    scene_bake.meshes.clear();
+    scene_bake.paths.clear();
+    scene_bake.model_matrices.clear();
+    scene_bake.meshes.push_back(&terrain_mesh);
+    scene_bake.paths.push_back("terrain_tex.obj");
+    scene_bake.model_matrices.push_back(scene_objects.world_matrices[terrain.entity]);
+    scene_bake.meshes.push_back(&base_mesh);
+    scene_bake.paths.push_back("base.obj");
+    scene_bake.model_matrices.push_back(scene_objects.world_matrices[base.entity]);
+    
+    scene_bake.lights.assign(main_scene.lights, main_scene.lights + main_scene.num_lights);
+    scene_bake.settings.ao_samples = BAKE_AO_SAMPLES;
+    scene_bake.settings.ao_distance = BAKE_AO_DISTANCE;
+    scene_bake.settings.shadows = GL_TRUE;
+    scene_bake.pool = &workers;
+    
+    bake_task_start(&scene_bake);
+}
+
+/* between frames: upload a finished bake, unless the scene changed while
+ * it ran (then it's stale, and the bake that was asked for starts) */
+static void bake_scene_collect(GLboolean wait) {
+    if (wait)
+        bake_task_wait(&scene_bake);
+    if (!bake_task_finished(&scene_bake))
+        return;
     
-    int i = main_camera.current_stage;
-    glm::vec3 delta_vector = main_camera.tour[i].end - main_camera.tour[i].start;
-    delta_vector *= (main_camera.tour[i].time_elapsed / main_camera.tour[i].duration);
-    main_camera.position = main_camera.tour[i].start + delta_vector;
+    if (rebake_pending) {
+        bake_scene();
+        return;
+    }
     
+    if (scene_bake.bake_ms > 0.0)
+        fprintf(stderr, "Baked static lighting in %.1f ms\n", scene_bake.bake_ms);
+    mesh_arena_upload_baked(&gpu_resources.arena, terrain.first_vertex, scene_bake.baked[0].baked);
+    mesh_arena_upload_baked(&gpu_resources.arena, base.first_vertex, scene_bake.baked[1].baked);
+    terrain_baked.swap(scene_bake.baked[0].baked);
+    base_baked.swap(scene_bake.baked[1].baked);
+}
 
-    GLfloat delta_angle = main_camera.tour[i].end_angle - main_camera.tour[i].start_angle;
-    delta_angle *= (main_camera.tour[i].time_elapsed / main_camera.tour[i].duration);
+/* a reloaded mesh gets a new arena range, unbaked (lit by ambient only):
+ * until its rebake lands, give it its previous version's lighting, by
+ * vertex index (vertices that version lacked get its average) */
+static void carry_baked(const struct model *obj_model,
+                        vector<glm::vec4> &baked,
+                        size_t num_vertices) {
+    if (baked.empty())
+        return;
     
-    main_camera.angles.x = main_camera.tour[i].start_angle + delta_angle;
+    glm::vec4 average = glm::vec4(0.0f);
+    size_t i;
+    for (i = 0; i < baked.size(); i++)
+        average += baked[i];
+    average /= (GLfloat)baked.size();
     
+    baked.resize(num_vertices, average);
+    mesh_arena_upload_baked(&gpu_resources.arena, obj_model->first_vertex, baked);
+}
+
+/* after a hot reload: point the models at their new GL objects, and keep
+ * the CPU meshes (and the terrain BVH) in step with reloaded .obj files */
+static void refresh_models() {
+    struct mesh_data reloaded_terrain, reloaded_base;
+    GLboolean terrain_changed, base_changed;
+    if (!model_refresh(&gpu_resources, &terrain, &reloaded_terrain, &terrain_changed))
+        fprintf(stderr, "The terrain's reloaded resources are incomplete; it may not draw\n");
+    if (!model_refresh(&gpu_resources, &base, &reloaded_base, &base_changed))
+        fprintf(stderr, "The base's reloaded resources are incomplete; it may not draw\n");
+    
+    /* a running bake reads the CPU meshes */
+    if (terrain_changed || base_changed)
+        bake_task_wait(&scene_bake);
+    if (terrain_changed) {
+        swap(terrain_mesh, reloaded_terrain);
+        bvh_build(&terrain_bvh, terrain_mesh.vertices, terrain_mesh.elements);
+        carry_baked(&terrain, terrain_baked, terrain_mesh.vertices.size());
+    }
+    if (base_changed) {
+        swap(base_mesh, reloaded_base);
+        carry_baked(&base, base_baked, base_mesh.vertices.size());
+    }
+}
+
+/* camera movement handler; called on every "tick" of the timer */
+static void timer_camera(GLdouble delta) {
+    camera_tour_step(&main_camera, delta);
     camera_recalculate_view_matrix();
-    
-    main_camera.tour[i].time_elapsed += delta;
 }
 
 /* earthquake movement handler; called on every "tick" */
@@ -261,29 +438,60 @@ static void timer_earthquake(GLdouble delta) {
     GLfloat time_periodicity_ratio = 500.0;
     GLfloat amplitude_basis = 0.005;
     
-    if (terrain.earthquake_on) {
-        terrain.earthquake_elapsed += delta;
+    if (terrain_quake.on) {
+        terrain_quake.elapsed += delta;
         
-        if(terrain.earthquake_elapsed > terrain.earthquake_duration) {
-            terrain.earthquake_on = GL_FALSE;
+        if(terrain_quake.elapsed > terrain_quake.duration) {
+            terrain_quake.on = GL_FALSE;
             return;
         }
         
-        if (terrain.earthquake_elapsed < terrain.earthquake_duration / 2)
-            terrain.earthquake_amplitude *= amplitude_change_rate;
+        if (terrain_quake.elapsed < terrain_quake.duration / 2)
+            terrain_quake.amplitude *= amplitude_change_rate;
         else
-            terrain.earthquake_amplitude /= amplitude_change_rate;
+            terrain_quake.amplitude /= amplitude_change_rate;
 
-        GLfloat displacement_1 = terrain.earthquake_amplitude * amplitude_basis * sinf(time_periodicity_ratio * terrain.earthquake_elapsed * delta);
-        GLfloat displacement_2 = terrain.earthquake_amplitude * amplitude_basis * sinf(time_periodicity_ratio * terrain.earthquake_elapsed * delta);
+        GLfloat displacement_1 = terrain_quake.amplitude * amplitude_basis * sinf(time_periodicity_ratio * terrain_quake.elapsed * delta);
+        GLfloat displacement_2 = terrain_quake.amplitude * amplitude_basis * sinf(time_periodicity_ratio * terrain_quake.elapsed * delta);
         
         
-        model_set_location(&terrain, terrain.position + glm::vec3(displacement_1, displacement_2, 0.0));
+        model_set_location(&terrain, model_location(&terrain) + glm::vec3(displacement_1, displacement_2, 0.0));
     }
 }
 
-/* initialise everything: lights, camera, models */
-static int init_resources() {
+/* parse the scene's .obj files; the terrain BVH, the GPU upload, the
+ * heightmap conversion and the software rasterizer all share these copies.
+ * A mesh that fails to load is left empty */
+static GLboolean load_scene_meshes() {
+    GLboolean ok = load_mesh("terrain_tex.obj", &terrain_mesh, GL_TRUE);
+    ok = load_mesh("base.obj", &base_mesh, GL_FALSE) && ok;
+    bvh_build(&terrain_bvh, terrain_mesh.vertices, terrain_mesh.elements);
+    return ok;
+}
+
+/* heightmap terrain: load the raw image given with --heightmap, or resample
+ * the terrain mesh, and compare its size with the mesh's */
+static void make_heightmap(const struct mesh_data *terrain_mesh) {
+    if (!heightmap_path
+        || !heightmap_load_raw(&terrain_heightmap, heightmap_path, HEIGHTMAP_RAW_SPACING, HEIGHTMAP_RAW_HEIGHT)) {
+        if (heightmap_path)
+            fprintf(stderr, "Unable to load %s; converting terrain_tex.obj instead\n", heightmap_path);
+        heightmap_from_mesh(&terrain_heightmap, terrain_mesh, &terrain_bvh,
+                            HEIGHTMAP_CONVERT_SIZE, HEIGHTMAP_CONVERT_SIZE);
+    }
+
+    size_t samples = (size_t)terrain_heightmap.width * terrain_heightmap.depth;
+    size_t mesh_bytes = terrain_mesh->vertices.size() * (sizeof(struct arena_vertex) + sizeof(glm::vec4))
+                        + terrain_mesh->elements.size() * sizeof(GLushort);
+    fprintf(stderr, "heightmap: %ux%u samples, %.1f bytes/sample (%.1f KB); mesh: %u vertices, %.1f bytes/vertex (%.1f KB)\n",
+            terrain_heightmap.width, terrain_heightmap.depth,
+            (GLdouble)heightmap_bytes(&terrain_heightmap) / samples, heightmap_bytes(&terrain_heightmap) / 1024.0,
+            (GLuint)terrain_mesh->vertices.size(),
+            (GLdouble)mesh_bytes / terrain_mesh->vertices.size(), mesh_bytes / 1024.0);
+}
+
+/* initialise the CPU side of the scene: lights, camera, model placement */
+static void init_scene() {
     // lighting
     light_make(glm::vec4(-0.451442, 3.999998, -3.918742, 0.0),
                glm::vec3(1.0, 0.5, 0.5),
@@ -295,68 +503,169 @@ static int init_resources() {
                 glm::vec3(0.0, 1.0, 0.0));
     
     // manually set up camera motion
-    camera_add_stage(glm::vec3(-3.158986, 0.600000, -5.130444), 1.0, 3.0);
-    camera_add_stage(glm::vec3(-0.939203, 0.800000, -2.144298), 3.0, 5.0);
-    camera_add_stage(glm::vec3(2.036759, 1.200000, -5.792756), -0.9, 5.0);
-    camera_add_stage(glm::vec3(2.339581, 1.200000, -8.596780), -0.460386, 3.0);
-    camera_add_stage(glm::vec3(-5.328159, 0.400000, -7.339204), 1.0, 3.0);
+    camera_add_stage(&main_camera, glm::vec3(-3.158986, 0.600000, -5.130444), 1.0, 3.0);
+    camera_add_stage(&main_camera, glm::vec3(-0.939203, 0.800000, -2.144298), 3.0, 5.0);
+    camera_add_stage(&main_camera, glm::vec3(2.036759, 1.200000, -5.792756), -0.9, 5.0);
+    camera_add_stage(&main_camera, glm::vec3(2.339581, 1.200000, -8.596780), -0.460386, 3.0);
+    camera_add_stage(&main_camera, glm::vec3(-5.328159, 0.400000, -7.339204), 1.0, 3.0);
+    
+    // scene objects
+    terrain.entity = scene_store_create(&scene_objects, SCENE_NO_PARENT);
+    base.entity = scene_store_create(&scene_objects, SCENE_NO_PARENT);
     
-    int error = make_model(&terrain, "terrain_tex.obj", "vert.glsl", "frag.glsl", "terrain_texture.tga");
-
     model_set_material(&terrain, glm::vec3(0.15));
     model_set_location(&terrain, glm::vec3(0.0, 0.0, -4.0));
     
-    terrain.earthquake_duration = 3.14;
-    terrain.earthquake_elapsed = 0.0;
-    terrain.earthquake_on = GL_FALSE;
-    terrain.earthquake_amplitude = 1.0;
+    /* meshes, and the spatial index over the terrain triangles (ground
+     * clamping, picking) */
+    load_scene_meshes();
+    
+    if (tiles_path && !tile_stream_open(&terrain_tiles, tiles_path, (size_t)tiles_budget_mb * 1024 * 1024))
+        fprintf(stderr, "Unable to stream %s; using a heightmap instead\n", tiles_path);
+    if (heightmap_terrain && !terrain_tiles.mapped)
+        make_heightmap(&terrain_mesh);
+    
+    model_set_material(&base, glm::vec3(0.15));
+    
+    terrain_quake.duration = 3.14;
+    terrain_quake.elapsed = 0.0;
+    terrain_quake.on = GL_FALSE;
+    terrain_quake.amplitude = 1.0;
+    
+    thread_pool_start(&workers, 0);
+}
+
+/* initialise everything: lights, camera, models */
+static int init_resources() {
+    init_scene();
+    resource_manager_init(&gpu_resources);
+    
+    /* baked lighting samples one texture array for every model, unless
+     * --no-texture-arrays */
+    const char *baked_textured = texture_arrays_off ? "frag_baked.glsl" : "frag_baked_array.glsl";
+    const char *baked_solid = texture_arrays_off ? "frag_baked_solid.glsl" : "frag_baked_array.glsl";
+    
+    int error;
+    if (terrain_tiles.mapped) {
+        error = make_model(&gpu_resources, &terrain, NULL, NULL,
+                           "vert_tiles.glsl", "frag_heightmap.glsl",
+                           "terrain_texture.tga");
+        tile_stream_create_atlas(&terrain_tiles);
+        glm::vec3 camera = main_camera.position - model_location(&terrain);
+        tile_stream_warm(&terrain_tiles, glm::vec2(camera.x, camera.z));
+    }
+    else if (heightmap_terrain) {
+        error = make_model(&gpu_resources, &terrain, NULL, NULL,
+                           "vert_heightmap.glsl", "frag_heightmap.glsl",
+                           "terrain_texture.tga");
+        if (error && !heightmap_upload(&terrain_heightmap))
+            error = 0;
+    }
+    else
+        error = make_model(&gpu_resources, &terrain, "terrain_tex.obj", &terrain_mesh,
+                           dynamic_lighting ? "vert.glsl" : "vert_baked.glsl",
+                           dynamic_lighting ? "frag.glsl" : baked_textured,
+                           "terrain_texture.tga");
+    
+    /* once streamed terrain has its tiles around the camera resident */
+    model_drop_to_ground(&base, 0.5, -4.5);
+    
+    if (error)
+        error = make_model(&gpu_resources, &base, "base.obj", &base_mesh,
+                           dynamic_lighting ? "vert.glsl" : "vert_baked.glsl",
+                           dynamic_lighting ? "frag_solid.glsl" : baked_solid,
+                           NULL);
+    
+    if (error) {
+        texture_arrays_build(&gpu_resources.arrays);
+        
+        /* nothing's on screen yet, so the first bake may as well be waited for */
+        bake_scene();
+        bake_scene_collect(GL_TRUE);
+    }
+    
+    hot_reload_init(&asset_watcher, ".");
     
     return error;
 }
 
+/* release all GPU resources while the context still exists */
+static void release_resources() {
+    capture_stop(&recorder);
+    if (!fixed_resolution)
+        resolution_destroy(&scaler);
+    hot_reload_close(&asset_watcher);
+    bake_task_wait(&scene_bake);
+    thread_pool_stop(&workers);
+    
+    model_release(&gpu_resources, &terrain);
+    model_release(&gpu_resources, &base);
+    if (terrain_tiles.mapped) {
+        tile_stream_report(&terrain_tiles, stderr);
+        tile_stream_close(&terrain_tiles);
+    }
+    else if (heightmap_terrain)
+        heightmap_release(&terrain_heightmap);
+    
+    fprintf(stderr, "last frame: %u passes, %u texture binds\n", last_frame_passes, last_frame_texture_binds);
+    resource_manager_report(&gpu_resources, stderr);
+    resource_manager_destroy(&gpu_resources);
+}
+
 /* dispatch key presses to the relevant function */
 void GLFWCALL handle_keypresses(int key, int action) {
     if(action == GLFW_RELEASE) {    
         /* Q/Esc.: quit */
         if(key == GLFW_KEY_ESC || key == 'Q') {
+            release_resources();
             glfwTerminate();
             exit(EXIT_SUCCESS);
         }
         
         /* T: begin camera tour */
         if(key == 'T') {
-            if(main_camera.stopped) {
-                int i;
-                for (i = 0; i < main_camera.num_stages; i++) {
-                    main_camera.tour[i].time_elapsed = 0.0;
-                    main_camera.tour[i].duration *= main_camera.rate;
-                }
-                main_camera.rate = 1.0;
-                main_camera.current_stage = 0;
-                main_camera.position = main_camera.tour[0].start;
-                main_camera.stopped = GL_FALSE;
-            }
+            camera_start_tour(&main_camera);
+        }
+        
+        /* C: start/stop recording frames */
+        if (key == 'C') {
+            if (recorder.active)
+                capture_stop(&recorder);
+            else
+                capture_start(&recorder, SCREEN_WIDTH, SCREEN_HEIGHT, capture_format, capture_path);
         }
         
         /* F: toggle free roam mode */
         if (key == 'F') {
             free_roam_mode = !free_roam_mode;
-            printf("Free roam mode %s\n\n", (free_roam_mode)?"enabled":"disabled");
+            fprintf(stderr, "Free roam mode %s\n\n", (free_roam_mode)?"enabled":"disabled");
         }
         
         if (key == 'E') {
-            terrain.earthquake_elapsed = 0.0;
-            terrain.earthquake_on = GL_TRUE;
-            terrain.earthquake_amplitude = 1.0;
+            terrain_quake.elapsed = 0.0;
+            terrain_quake.on = GL_TRUE;
+            terrain_quake.amplitude = 1.0;
+        }
+        
+        /* R: report GPU resource usage */
+        if (key == 'R') {
+            resource_manager_report(&gpu_resources, stderr);
+            mesh_arena_report(&gpu_resources.arena, stderr);
+            texture_arrays_report(&gpu_resources.arrays, stderr);
+            fprintf(stderr, "last frame: %u passes, %u texture binds\n", last_frame_passes, last_frame_texture_binds);
+            if (!fixed_resolution)
+                resolution_report(&scaler, stderr);
+            if (terrain_tiles.mapped)
+                tile_stream_report(&terrain_tiles, stderr);
         }
         
         /* <up>/<down> Alter speed of tour */
         if (key == GLFW_KEY_UP) {
-            camera_rate(0.1);
+            camera_rate(&main_camera, 0.1);
         }
         
         if (key == GLFW_KEY_DOWN) {
-            camera_rate(-0.1);
+            camera_rate(&main_camera, -0.1);
         }
         
         if (free_roam_mode) {
@@ -384,11 +693,16 @@ void GLFWCALL handle_keypresses(int key, int action) {
                     break;
                 case GLFW_KEY_DOWN:
                     camera_translate(main_camera.up, -0.1);
+                    break;
+                case 'G':
+                    model_drop_at_lookat(&base);
+                    bake_scene();
+                    break;
                 default:
                     break;
             }
             
-            fprintf(stdout, "pos: glm::vec3(%f, %f, %f) \nangles: glm::vec2(%f, %f)\n\n",
+            fprintf(stderr, "pos: glm::vec3(%f, %f, %f) \nangles: glm::vec2(%f, %f)\n\n",
                     main_camera.position.x, main_camera.position.y, main_camera.position.z,
                     main_camera.angles.x, main_camera.angles.y);
         }
@@ -397,12 +711,34 @@ void GLFWCALL handle_keypresses(int key, int action) {
 
 /* called on Esc/Q/q; terminate the glfw window */
 int GLFWCALL close_window(void) {
+    release_resources();
     glfwTerminate();
     exit(EXIT_SUCCESS);
 }
 
+/* bring in the terrain tiles around the camera, and those the tour will
+ * pass over next */
+static void stream_terrain() {
+    glm::vec3 terrain_position = model_location(&terrain);
+    glm::vec3 camera = main_camera.position - terrain_position;
+    
+    vector<glm::vec3> ahead;
+    camera_tour_ahead(&main_camera, TILE_PREFETCH_SECONDS, TILE_PREFETCH_STEP, ahead);
+    vector<glm::vec2> upcoming(ahead.size());
+    size_t i;
+    for (i = 0; i < ahead.size(); i++)
+        upcoming[i] = glm::vec2(ahead[i].x - terrain_position.x, ahead[i].z - terrain_position.z);
+    
+    tile_stream_update(&terrain_tiles, glm::vec2(camera.x, camera.z),
+                       upcoming.empty() ? NULL : &upcoming[0], (GLuint)upcoming.size());
+    tile_stream_upload(&terrain_tiles);
+}
+
 /* here be renderin' */
 static void render(void) {    
+    if (!fixed_resolution)
+        resolution_begin_frame(&scaler);
+    
     /* clear buffer */
     glClearColor(0.1f, 0.1f, 0.15f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
@@ -414,24 +750,204 @@ static void render(void) {
     last_known_time = current_time;
     timer_camera(delta);
     timer_earthquake(delta);
+    scene_store_update(&scene_objects);
+    
+    if (terrain_tiles.mapped)
+        stream_terrain();
+    
+    frame_passes = frame_texture_binds = 0;
+    bound_texture = 0;
     
-    model_render(&terrain);
-    model_render(&base);
+    if (heightmap_terrain) {
+        struct model *models[] = { &base };
+        model_render(models, 1);
+        
+        /* the terrain has no mesh: one instanced draw of grid patches */
+        model_bind(&terrain);
+        glUniformMatrix4fv(terrain.uniforms.model, 1, GL_FALSE,
+                           glm::value_ptr(scene_objects.world_matrices[terrain.entity]));
+        glUniformMatrix3fv(terrain.uniforms.model_inv, 1, GL_FALSE,
+                           glm::value_ptr(scene_objects.normal_matrices[terrain.entity]));
+        if (terrain_tiles.mapped)
+            tile_stream_draw(&terrain_tiles, terrain.program);
+        else
+            heightmap_draw(&terrain_heightmap, terrain.program);
+    }
+    else {
+        struct model *models[] = { &terrain, &base };
+        model_render(models, 2);
+    }
+    
+    last_frame_passes = frame_passes;
+    last_frame_texture_binds = frame_texture_binds;
+    
+    /* upscale to the window */
+    if (!fixed_resolution)
+        resolution_end_frame(&scaler);
+}
+
+/* wall clock time without glfw (which needs a display to initialise) */
+static GLdouble now_seconds() {
+    return chrono::duration<GLdouble>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* play the camera tour through the software rasterizer (no window or GL
+ * context needed), optionally writing every frame as <prefix>NNNN.ppm */
+static int run_software_tour(const char *output_prefix) {
+    init_scene();
+    
+    if (terrain_mesh.elements.empty() || base_mesh.elements.empty()) {
+        fprintf(stderr, "Failed to load meshes\n");
+        return 1;
+    }
+    
+    struct softrast_texture terrain_texture;
+    GLboolean textured = softrast_load_tga("terrain_texture.tga", &terrain_texture);
+    
+    struct softrast_target target;
+    softrast_target_resize(&target, SCREEN_WIDTH, SCREEN_HEIGHT);
+    
+    struct softrast_context context;
+    context.pool = &workers;
+    context.target = &target;
+    
+    struct softrast_model models[2];
+    models[0].mesh = &terrain_mesh;
+    models[0].texture = textured ? &terrain_texture : NULL;
+    models[0].ambient = terrain.material.ambient;
+    models[1].mesh = &base_mesh;
+    models[1].texture = NULL;
+    models[1].ambient = base.material.ambient;
+    
+    camera_start_tour(&main_camera);
+    
+    GLuint frame = 0;
+    GLdouble start = now_seconds();
+    while (!main_camera.stopped) {
+        timer_camera(SOFTWARE_FRAME_TIME);
+        scene_store_update(&scene_objects);
+        
+        models[0].model_matrix = scene_objects.world_matrices[terrain.entity];
+        models[0].normal_matrix = scene_objects.normal_matrices[terrain.entity];
+        models[1].model_matrix = scene_objects.world_matrices[base.entity];
+        models[1].normal_matrix = scene_objects.normal_matrices[base.entity];
+        
+        softrast_clear(&target, glm::vec4(0.1f, 0.1f, 0.15f, 1.0f));
+        softrast_draw(&context, models, 2,
+                      main_scene.view_matrix, main_scene.projection_matrix,
+                      main_scene.lights, main_scene.num_lights);
+        
+        if (output_prefix) {
+            char path[256];
+            snprintf(path, sizeof(path), "%s%04u.ppm", output_prefix, frame);
+            softrast_write_ppm(&target, path);
+        }
+        frame += 1;
+    }
+    GLdouble elapsed = now_seconds() - start;
+    
+    printf("%u frames in %.2f s: %.2f ms/frame, %.1f fps (%u threads)\n",
+           frame, elapsed, 1000.0 * elapsed / frame, frame / elapsed,
+           (GLuint)workers.workers.size() + 1);
+    
+    thread_pool_stop(&workers);
+    return 0;
+}
+
+/* write the heightmap terrain out as a tile file */
+static GLboolean make_tile_file(const char *path) {
+    if (!load_scene_meshes())
+        return GL_FALSE;
+    make_heightmap(&terrain_mesh);
+    
+    return tile_file_write(&terrain_heightmap, path);
 }
 
 int main(int argc, char** argv) {
     int running = GL_TRUE;
     
+    int arg;
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--dynamic-lighting") == 0)
+            dynamic_lighting = GL_TRUE;
+        if (strcmp(argv[arg], "--no-texture-arrays") == 0)
+            texture_arrays_off = GL_TRUE;
+        
+        /* --heightmap [file.r16]: terrain from a heightmap (baked lighting
+         * is per mesh vertex, so this lights everything per pixel) */
+        if (strcmp(argv[arg], "--heightmap") == 0) {
+            heightmap_terrain = GL_TRUE;
+            dynamic_lighting = GL_TRUE;
+            if (arg + 1 < argc && argv[arg+1][0] != '-')
+                heightmap_path = argv[++arg];
+        }
+        
+        /* --stream file.tiles [--stream-budget MB]: page the terrain in
+         * from a tile file (made with --make-tiles) */
+        if (strcmp(argv[arg], "--stream") == 0 && arg + 1 < argc) {
+            tiles_path = argv[++arg];
+            heightmap_terrain = GL_TRUE;
+            dynamic_lighting = GL_TRUE;
+        }
+        if (strcmp(argv[arg], "--stream-budget") == 0 && arg + 1 < argc)
+            tiles_budget_mb = (GLuint)atoi(argv[++arg]);
+        
+        /* --capture prefix / --capture-raw file: record the tour */
+        if (strcmp(argv[arg], "--capture") == 0 && arg + 1 < argc) {
+            capture_format = CAPTURE_PPM;
+            capture_path = argv[++arg];
+            capture_tour = GL_TRUE;
+        }
+        if (strcmp(argv[arg], "--capture-raw") == 0 && arg + 1 < argc) {
+            capture_format = CAPTURE_RAW;
+            capture_path = argv[++arg];
+            capture_tour = GL_TRUE;
+        }
+        
+        /* --fixed-resolution: no offscreen target or scaling, FSAA in the window */
+        if (strcmp(argv[arg], "--fixed-resolution") == 0)
+            fixed_resolution = GL_TRUE;
+        if (strcmp(argv[arg], "--resolution-log") == 0)
+            scaler.log_decisions = GL_TRUE;
+        
+        /* --compare a.ppm b.ppm: difference between two frames */
+        if (strcmp(argv[arg], "--compare") == 0 && arg + 2 < argc) {
+            GLfloat rms;
+            GLuint max_error;
+            if (!softrast_compare_ppm(argv[arg+1], argv[arg+2], &rms, &max_error))
+                return 1;
+            printf("rms error %f, max error %u\n", rms, max_error);
+            return 0;
+        }
+    }
+    
+    /* --make-tiles out.tiles: split the heightmap (--heightmap file.r16,
+     * or terrain_tex.obj resampled) into a tile file for --stream */
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--make-tiles") == 0 && arg + 1 < argc)
+            return make_tile_file(argv[arg+1]) ? 0 : 1;
+    }
+    
+    /* --software [prefix]: CPU-rendered tour; no window, display or glfw */
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--software") == 0)
+            return run_software_tour((arg + 1 < argc && argv[arg+1][0] != '-') ? argv[arg+1] : NULL);
+    }
+    
 	if (!glfwInit()) {
 		exit(EXIT_FAILURE);
 	}
     
     // set hints to open a GL3.2 context (otherwise it will do 2.1 by default on Mac)
-    glfwOpenWindowHint(GLFW_FSAA_SAMPLES, 4);
 	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
 	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
 	glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     
+    /* with dynamic resolution, multisampling happens offscreen: a scaled
+     * blit can't target a multisampled window */
+	if (fixed_resolution)
+		glfwOpenWindowHint(GLFW_FSAA_SAMPLES, FSAA_SAMPLES);
+    
 	if (!glfwOpenWindow(SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0, 0, 0, 16, 0, GLFW_WINDOW)) {
 		glfwTerminate();
 		exit(EXIT_FAILURE);
@@ -448,16 +964,38 @@ int main(int argc, char** argv) {
 	glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
     
+    if (!fixed_resolution && !resolution_init(&scaler, SCREEN_WIDTH, SCREEN_HEIGHT, FSAA_SAMPLES)) {
+        resolution_destroy(&scaler);
+        fixed_resolution = GL_TRUE;
+    }
+    
     if(!init_resources()) {
-        fprintf(stdout, "Failed to load resources");
+        fprintf(stderr, "Failed to load resources\n");
         return 1;
     }
     
+    if (capture_tour) {
+        camera_start_tour(&main_camera);
+        capture_start(&recorder, SCREEN_WIDTH, SCREEN_HEIGHT, capture_format, capture_path);
+    }
+    
 	while (running) {
+        /* swap in changed assets between frames */
+        if (hot_reload_poll(&asset_watcher, &gpu_resources) > 0) {
+            refresh_models();
+            bake_scene();
+        }
+        bake_scene_collect(GL_FALSE);
+        
 		render();
+        capture_frame(&recorder);
         glfwSwapBuffers();
+        
+        if (capture_tour && recorder.active && main_camera.stopped)
+            capture_stop(&recorder);
 	}
     
+    release_resources();
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
 }
\ No newline at end of file
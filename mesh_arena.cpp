@@ -0,0 +1,415 @@
+#include <GL/glew.h>
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "util.h"
+#include "mesh_arena.h"
+
+using namespace std;
+
+/*
+ * Shared vertex/index arena: instead of a VAO and four buffers per mesh,
+ * every mesh is suballocated out of a few large buffers behind one VAO.
+ * A pass then needs one VAO bind, and with GL_ARB_multi_draw_indirect all
+ * of its meshes go out in a single glMultiDrawElementsIndirect call.
+ */
+
+/*
+ * range allocator
+ */
+
+void arena_allocator_init(struct arena_allocator *allocator,
+                          GLuint capacity) {
+    allocator->capacity = capacity;
+    allocator->used = 0;
+    allocator->free_blocks.clear();
+    if (capacity > 0)
+        allocator->free_blocks[0] = capacity;
+}
+
+/* add [offset, offset + size) to the free list, merging with its neighbours */
+static void arena_insert_free(struct arena_allocator *allocator,
+                              GLuint offset,
+                              GLuint size) {
+    map<GLuint, GLuint>::iterator next = allocator->free_blocks.lower_bound(offset);
+
+    if (next != allocator->free_blocks.begin()) {
+        map<GLuint, GLuint>::iterator prev = next;
+        --prev;
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            allocator->free_blocks.erase(prev);
+        }
+    }
+
+    if (next != allocator->free_blocks.end() && offset + size == next->first) {
+        size += next->second;
+        allocator->free_blocks.erase(next);
+    }
+
+    allocator->free_blocks[offset] = size;
+}
+
+/* first fit; GL_FALSE if no free block is big enough */
+GLboolean arena_allocate(struct arena_allocator *allocator,
+                         GLuint size,
+                         GLuint *offset) {
+    if (size == 0)
+        return GL_FALSE;
+
+    map<GLuint, GLuint>::iterator it;
+    for (it = allocator->free_blocks.begin(); it != allocator->free_blocks.end(); ++it) {
+        if (it->second < size)
+            continue;
+
+        *offset = it->first;
+        GLuint remaining = it->second - size;
+        allocator->free_blocks.erase(it);
+        if (remaining > 0)
+            allocator->free_blocks[*offset + size] = remaining;
+
+        allocator->used += size;
+        return GL_TRUE;
+    }
+
+    return GL_FALSE;
+}
+
+void arena_free(struct arena_allocator *allocator,
+                GLuint offset,
+                GLuint size) {
+    if (size == 0)
+        return;
+
+    arena_insert_free(allocator, offset, size);
+    allocator->used -= size;
+}
+
+/* extend the range; the new space is free (and merges with a free tail) */
+void arena_grow(struct arena_allocator *allocator,
+                GLuint capacity) {
+    if (capacity <= allocator->capacity)
+        return;
+
+    arena_insert_free(allocator, allocator->capacity, capacity - allocator->capacity);
+    allocator->capacity = capacity;
+}
+
+void arena_allocator_stats(const struct arena_allocator *allocator,
+                           struct arena_stats *stats) {
+    GLuint total_free = 0;
+    stats->largest_free = 0;
+
+    map<GLuint, GLuint>::const_iterator it;
+    for (it = allocator->free_blocks.begin(); it != allocator->free_blocks.end(); ++it) {
+        total_free += it->second;
+        if (it->second > stats->largest_free)
+            stats->largest_free = it->second;
+    }
+
+    stats->capacity = allocator->capacity;
+    stats->used = allocator->used;
+    stats->free_blocks = (GLuint)allocator->free_blocks.size();
+    stats->occupancy = allocator->capacity ? (GLfloat)allocator->used / allocator->capacity : 0.0f;
+    stats->fragmentation = total_free ? 1.0f - (GLfloat)stats->largest_free / total_free : 0.0f;
+}
+
+/*
+ * GL buffers
+ */
+
+/* point the shared VAO at the current buffers (again, after they grew) */
+static void mesh_arena_bind_attributes(struct mesh_arena *arena) {
+    glBindVertexArray(arena->vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, arena->vertex_buffer);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(struct arena_vertex),
+                          (void*)offsetof(struct arena_vertex, position));
+    glEnableVertexAttribArray(ATTRIB_NORMAL);
+    glVertexAttribPointer(ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, sizeof(struct arena_vertex),
+                          (void*)offsetof(struct arena_vertex, normal));
+    glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+    glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(struct arena_vertex),
+                          (void*)offsetof(struct arena_vertex, tex_coord));
+
+    glBindBuffer(GL_ARRAY_BUFFER, arena->baked_buffer);
+    glEnableVertexAttribArray(ATTRIB_BAKED);
+    glVertexAttribPointer(ATTRIB_BAKED, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    /* one value per instance; base_instance of each command selects the draw */
+    if (arena->multi_draw_indirect) {
+        glBindBuffer(GL_ARRAY_BUFFER, arena->draw_id_buffer);
+        glEnableVertexAttribArray(ATTRIB_DRAW_ID);
+        glVertexAttribIPointer(ATTRIB_DRAW_ID, 1, GL_INT, 0, (void*)0);
+        glVertexAttribDivisor(ATTRIB_DRAW_ID, 1);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->index_buffer);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* empty buffer of the given size (uploads go through GL_COPY_WRITE_BUFFER
+ * so they never disturb the VAO's element buffer binding) */
+static GLuint mesh_arena_make_buffer(GLsizeiptr bytes) {
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+    return buffer;
+}
+
+/* replace a buffer with a bigger one holding the same contents */
+static void mesh_arena_resize_buffer(GLuint *buffer,
+                                     GLsizeiptr old_bytes,
+                                     GLsizeiptr new_bytes) {
+    GLuint bigger = mesh_arena_make_buffer(new_bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_bytes);
+    glDeleteBuffers(1, buffer);
+    *buffer = bigger;
+}
+
+void mesh_arena_init(struct mesh_arena *arena) {
+    /* the draw id attribute needs glVertexAttribDivisor as well */
+    arena->multi_draw_indirect = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance
+                                 && (GLEW_ARB_instanced_arrays || GLEW_VERSION_3_3);
+
+    arena_allocator_init(&arena->vertices, ARENA_INITIAL_VERTICES);
+    arena_allocator_init(&arena->indices, ARENA_INITIAL_INDICES);
+
+    arena->vertex_buffer = mesh_arena_make_buffer(sizeof(struct arena_vertex) * ARENA_INITIAL_VERTICES);
+    arena->baked_buffer = mesh_arena_make_buffer(sizeof(glm::vec4) * ARENA_INITIAL_VERTICES);
+    arena->index_buffer = mesh_arena_make_buffer(sizeof(GLushort) * ARENA_INITIAL_INDICES);
+    arena->indirect_buffer = 0;
+    arena->draw_id_buffer = 0;
+
+    if (arena->multi_draw_indirect) {
+        GLint draw_ids[ARENA_MAX_DRAWS];
+        GLint i;
+        for (i = 0; i < ARENA_MAX_DRAWS; i++)
+            draw_ids[i] = i;
+        arena->draw_id_buffer = make_buffer(GL_ARRAY_BUFFER, draw_ids, sizeof(draw_ids));
+
+        glGenBuffers(1, &arena->indirect_buffer);
+    }
+
+    glGenVertexArrays(1, &arena->vao);
+    mesh_arena_bind_attributes(arena);
+
+    arena->commands.reserve(ARENA_MAX_DRAWS);
+    arena->calls = arena->draws = 0;
+}
+
+void mesh_arena_destroy(struct mesh_arena *arena) {
+    glDeleteVertexArrays(1, &arena->vao);
+    glDeleteBuffers(1, &arena->vertex_buffer);
+    glDeleteBuffers(1, &arena->baked_buffer);
+    glDeleteBuffers(1, &arena->index_buffer);
+    glDeleteBuffers(1, &arena->indirect_buffer);  /* 0 is ignored */
+    glDeleteBuffers(1, &arena->draw_id_buffer);
+
+    arena->vao = 0;
+    arena->vertex_buffer = arena->baked_buffer = arena->index_buffer = 0;
+    arena->indirect_buffer = arena->draw_id_buffer = 0;
+    arena_allocator_init(&arena->vertices, 0);
+    arena_allocator_init(&arena->indices, 0);
+    arena->commands.clear();
+}
+
+/* capacity at least doubles, so a run of uploads costs amortised O(1) copies */
+static GLuint mesh_arena_new_capacity(GLuint capacity,
+                                      GLuint needed) {
+    GLuint grown = capacity * 2;
+    while (grown < capacity + needed)
+        grown *= 2;
+    return grown;
+}
+
+/* copy a mesh into the arena; the VAO stays the same, the buffers behind
+ * it may be replaced if they had to grow */
+GLboolean mesh_arena_add(struct mesh_arena *arena,
+                         const struct mesh_data *mesh,
+                         GLuint *first_vertex,
+                         GLuint *first_index) {
+    GLuint num_vertices = (GLuint)mesh->vertices.size();
+    GLuint num_indices = (GLuint)mesh->elements.size();
+    GLboolean regrown = GL_FALSE;
+
+    if (!arena_allocate(&arena->vertices, num_vertices, first_vertex)) {
+        GLuint capacity = mesh_arena_new_capacity(arena->vertices.capacity, num_vertices);
+        mesh_arena_resize_buffer(&arena->vertex_buffer,
+                                 sizeof(struct arena_vertex) * arena->vertices.capacity,
+                                 sizeof(struct arena_vertex) * capacity);
+        mesh_arena_resize_buffer(&arena->baked_buffer,
+                                 sizeof(glm::vec4) * arena->vertices.capacity,
+                                 sizeof(glm::vec4) * capacity);
+        arena_grow(&arena->vertices, capacity);
+        regrown = GL_TRUE;
+
+        if (!arena_allocate(&arena->vertices, num_vertices, first_vertex))
+            return GL_FALSE;
+    }
+
+    if (!arena_allocate(&arena->indices, num_indices, first_index)) {
+        GLuint capacity = mesh_arena_new_capacity(arena->indices.capacity, num_indices);
+        mesh_arena_resize_buffer(&arena->index_buffer,
+                                 sizeof(GLushort) * arena->indices.capacity,
+                                 sizeof(GLushort) * capacity);
+        arena_grow(&arena->indices, capacity);
+        regrown = GL_TRUE;
+
+        if (!arena_allocate(&arena->indices, num_indices, first_index)) {
+            arena_free(&arena->vertices, *first_vertex, num_vertices);
+            return GL_FALSE;
+        }
+    }
+
+    if (regrown)
+        mesh_arena_bind_attributes(arena);
+
+    /* interleave; meshes without texture coordinates get (0, 0) */
+    vector<struct arena_vertex> vertices(num_vertices);
+    GLuint i;
+    for (i = 0; i < num_vertices; i++) {
+        vertices[i].position = mesh->vertices[i];
+        vertices[i].normal = (i < mesh->normals.size()) ? mesh->normals[i] : glm::vec3(0.0);
+        vertices[i].tex_coord = (i < mesh->tex_coords.size()) ? mesh->tex_coords[i] : glm::vec2(0.0);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->vertex_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+                    sizeof(struct arena_vertex) * *first_vertex,
+                    sizeof(struct arena_vertex) * num_vertices,
+                    &vertices[0]);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->index_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+                    sizeof(GLushort) * *first_index,
+                    sizeof(GLushort) * num_indices,
+                    &mesh->elements[0]);
+
+    /* unbaked: no direct light, fully open (what a disabled in_Baked would read) */
+    mesh_arena_upload_baked(arena, *first_vertex, vector<glm::vec4>(num_vertices, glm::vec4(0.0, 0.0, 0.0, 1.0)));
+
+    return GL_TRUE;
+}
+
+void mesh_arena_remove(struct mesh_arena *arena,
+                       GLuint first_vertex,
+                       GLuint num_vertices,
+                       GLuint first_index,
+                       GLuint num_indices) {
+    arena_free(&arena->vertices, first_vertex, num_vertices);
+    arena_free(&arena->indices, first_index, num_indices);
+}
+
+/* per-vertex baked lighting for the mesh starting at first_vertex */
+void mesh_arena_upload_baked(struct mesh_arena *arena,
+                             GLuint first_vertex,
+                             const vector<glm::vec4> &baked) {
+    if (baked.empty())
+        return;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->baked_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+                    sizeof(glm::vec4) * first_vertex,
+                    sizeof(glm::vec4) * baked.size(),
+                    &baked[0]);
+}
+
+/*
+ * draw submission
+ */
+
+/* queue one mesh; it is drawn with in_DrawID = its position in the queue.
+ * At most ARENA_MAX_DRAWS can be queued between submits: the caller sets
+ * the per-draw uniforms for the whole queue, so a full queue can't be
+ * submitted from here. Draws past the limit are dropped */
+void mesh_arena_draw(struct mesh_arena *arena,
+                     GLuint first_index,
+                     GLuint num_indices,
+                     GLuint first_vertex) {
+    assert(arena->commands.size() < ARENA_MAX_DRAWS);
+    if (arena->commands.size() >= ARENA_MAX_DRAWS) {
+        fprintf(stderr, "Too many draws queued in the mesh arena\n");
+        return;
+    }
+
+    struct draw_elements_indirect_command command;
+    command.count = num_indices;
+    command.instance_count = 1;
+    command.first_index = first_index;
+    command.base_vertex = (GLint)first_vertex;
+    command.base_instance = (GLuint)arena->commands.size();
+
+    arena->commands.push_back(command);
+}
+
+/* draw everything queued (with the current program & uniforms) */
+void mesh_arena_submit(struct mesh_arena *arena) {
+    GLsizei count = (GLsizei)arena->commands.size();
+    if (count == 0)
+        return;
+
+    glBindVertexArray(arena->vao);
+
+    if (arena->multi_draw_indirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, arena->indirect_buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                     sizeof(struct draw_elements_indirect_command) * count,
+                     &arena->commands[0],
+                     GL_STREAM_DRAW);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (void*)0, count, 0);
+        arena->calls += 1;
+    }
+    else {
+        /* the draw id attribute array is disabled, so it reads the current
+         * generic value: set it per draw */
+        GLsizei i;
+        for (i = 0; i < count; i++) {
+            const struct draw_elements_indirect_command *command = &arena->commands[i];
+            glVertexAttribI1i(ATTRIB_DRAW_ID, (GLint)command->base_instance);
+            glDrawElementsBaseVertex(GL_TRIANGLES,
+                                     command->count,
+                                     GL_UNSIGNED_SHORT,
+                                     (void*)(sizeof(GLushort) * command->first_index),
+                                     command->base_vertex);
+        }
+        arena->calls += count;
+    }
+
+    arena->draws += count;
+    arena->commands.clear();
+}
+
+/* occupancy & fragmentation of both buffers, and draws per call since the
+ * last report */
+void mesh_arena_report(struct mesh_arena *arena,
+                       FILE *out) {
+    struct arena_stats vertices, indices;
+    arena_allocator_stats(&arena->vertices, &vertices);
+    arena_allocator_stats(&arena->indices, &indices);
+
+    fprintf(out, "mesh arena: vertices %u/%u (%.1f%%, %u free blocks, fragmentation %.2f), "
+                 "indices %u/%u (%.1f%%, %u free blocks, fragmentation %.2f)\n",
+            vertices.used, vertices.capacity, vertices.occupancy * 100.0f,
+            vertices.free_blocks, vertices.fragmentation,
+            indices.used, indices.capacity, indices.occupancy * 100.0f,
+            indices.free_blocks, indices.fragmentation);
+    fprintf(out, "mesh arena: %u draws in %u calls (%s)\n",
+            arena->draws, arena->calls,
+            arena->multi_draw_indirect ? "multi-draw indirect" : "per-draw fallback");
+
+    arena->calls = arena->draws = 0;
+}
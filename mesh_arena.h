@@ -0,0 +1,97 @@
+#define ARENA_MAX_DRAWS 16              /* per multi-draw call; the length of model[] in vert_baked.glsl */
+#define ARENA_INITIAL_VERTICES 65536
+#define ARENA_INITIAL_INDICES 262144
+
+/* structure definitions */
+
+/* first-fit range allocator with coalescing free list; units are whatever
+ * the caller allocates (vertices, indices) */
+struct arena_allocator {
+    GLuint capacity;
+    GLuint used;
+    std::map<GLuint, GLuint> free_blocks;   /* offset -> size, never adjacent */
+};
+
+struct arena_stats {
+    GLuint capacity;
+    GLuint used;
+    GLuint free_blocks;
+    GLuint largest_free;
+    GLfloat occupancy;          /* used / capacity */
+    GLfloat fragmentation;      /* 1 - largest free block / total free: 0 = one free block */
+};
+
+/* one vertex of the shared vertex buffer */
+struct arena_vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 tex_coord;
+};
+
+/* layout fixed by GL (DrawElementsIndirectCommand) */
+struct draw_elements_indirect_command {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;       /* = index of the draw within its call, read back as in_DrawID */
+};
+
+/* every mesh's vertices & indices packed into shared buffers behind one
+ * VAO; meshes are addressed by base vertex + first index */
+struct mesh_arena {
+    GLuint vao;
+    GLuint vertex_buffer;       /* struct arena_vertex */
+    GLuint baked_buffer;        /* vec4 per vertex, parallel to vertex_buffer (see bake.h) */
+    GLuint index_buffer;        /* GLushort, relative to the mesh's base vertex */
+    GLuint indirect_buffer;
+    GLuint draw_id_buffer;      /* 0 .. ARENA_MAX_DRAWS-1, one per instance */
+
+    struct arena_allocator vertices;
+    struct arena_allocator indices;
+
+    GLboolean multi_draw_indirect;  /* else one glDrawElementsBaseVertex per command */
+    std::vector<struct draw_elements_indirect_command> commands;
+
+    GLuint calls;               /* draw calls & draws issued, since last report */
+    GLuint draws;
+};
+
+/* function prototypes */
+void arena_allocator_init(struct arena_allocator *allocator,
+                          GLuint capacity);
+GLboolean arena_allocate(struct arena_allocator *allocator,
+                         GLuint size,
+                         GLuint *offset);
+void arena_free(struct arena_allocator *allocator,
+                GLuint offset,
+                GLuint size);
+void arena_grow(struct arena_allocator *allocator,
+                GLuint capacity);
+void arena_allocator_stats(const struct arena_allocator *allocator,
+                           struct arena_stats *stats);
+
+void mesh_arena_init(struct mesh_arena *arena);
+void mesh_arena_destroy(struct mesh_arena *arena);
+
+GLboolean mesh_arena_add(struct mesh_arena *arena,
+                         const struct mesh_data *mesh,
+                         GLuint *first_vertex,
+                         GLuint *first_index);
+void mesh_arena_remove(struct mesh_arena *arena,
+                       GLuint first_vertex,
+                       GLuint num_vertices,
+                       GLuint first_index,
+                       GLuint num_indices);
+void mesh_arena_upload_baked(struct mesh_arena *arena,
+                             GLuint first_vertex,
+                             const std::vector<glm::vec4> &baked);
+
+void mesh_arena_draw(struct mesh_arena *arena,
+                     GLuint first_index,
+                     GLuint num_indices,
+                     GLuint first_vertex);
+void mesh_arena_submit(struct mesh_arena *arena);
+
+void mesh_arena_report(struct mesh_arena *arena,
+                       FILE *out);
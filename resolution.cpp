@@ -0,0 +1,266 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "resolution.h"
+
+/*
+ * Dynamic resolution: GPU time per frame is measured with GL_TIME_ELAPSED
+ * queries (read back a few frames later, so nothing waits on the GPU) and
+ * the offscreen render size is scaled so that it stays within budget.
+ * Pixel cost goes with the square of the scale, so scaling down to fit is
+ * one step of sqrt(target / measured) (aiming a little under); scaling
+ * back up is slow and only with clear headroom, so the controller doesn't
+ * oscillate.
+ */
+
+static const char *resolution_decision_names[] = { "hold", "down", "up" };
+
+/* render size for a scale: aligned, at least one block, at most the window */
+static GLuint resolution_scaled_size(GLuint window_size,
+                                     GLfloat scale) {
+    GLuint size = (GLuint)(window_size * scale / RESOLUTION_ALIGN + 0.5f) * RESOLUTION_ALIGN;
+    if (size < RESOLUTION_ALIGN)
+        size = RESOLUTION_ALIGN;
+    if (size > window_size)
+        size = window_size;
+    return size;
+}
+
+void resolution_set_scale(struct resolution_scaler *scaler,
+                          GLfloat scale) {
+    if (scale < RESOLUTION_MIN_SCALE)
+        scale = RESOLUTION_MIN_SCALE;
+    if (scale > RESOLUTION_MAX_SCALE)
+        scale = RESOLUTION_MAX_SCALE;
+
+    scaler->scale = scale;
+    scaler->render_width = resolution_scaled_size(scaler->window_width, scale);
+    scaler->render_height = resolution_scaled_size(scaler->window_height, scale);
+}
+
+/* renderbuffer-backed framebuffer; depth is optional */
+static GLboolean resolution_make_target(GLuint width,
+                                        GLuint height,
+                                        GLuint samples,
+                                        GLuint *fbo,
+                                        GLuint *colour,
+                                        GLuint *depth) {
+    glGenFramebuffers(1, fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+
+    glGenRenderbuffers(1, colour);
+    glBindRenderbuffer(GL_RENDERBUFFER, *colour);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, *colour);
+
+    if (depth) {
+        glGenRenderbuffers(1, depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, *depth);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, *depth);
+    }
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Offscreen framebuffer incomplete (0x%x)\n", status);
+        return GL_FALSE;
+    }
+    return GL_TRUE;
+}
+
+/* needs a GL context; samples > 1 renders multisampled and resolves before
+ * upscaling (a scaled blit can't read a multisampled buffer) */
+GLboolean resolution_init(struct resolution_scaler *scaler,
+                          GLuint window_width,
+                          GLuint window_height,
+                          GLuint samples) {
+    scaler->window_width = window_width;
+    scaler->window_height = window_height;
+    scaler->samples = samples > 1 ? samples : 0;
+    resolution_set_scale(scaler, RESOLUTION_MAX_SCALE);
+
+    scaler->resolve_fbo = scaler->resolve_colour = 0;
+    if (!resolution_make_target(window_width, window_height, scaler->samples,
+                                &scaler->scene_fbo, &scaler->scene_colour, &scaler->scene_depth))
+        return GL_FALSE;
+    if (scaler->samples
+        && !resolution_make_target(window_width, window_height, 0,
+                                   &scaler->resolve_fbo, &scaler->resolve_colour, NULL))
+        return GL_FALSE;
+
+    scaler->timed = GLEW_ARB_timer_query;
+    if (scaler->timed)
+        glGenQueries(RESOLUTION_QUERY_RING, scaler->queries);
+    int i;
+    for (i = 0; i < RESOLUTION_QUERY_RING; i++)
+        scaler->query_pending[i] = GL_FALSE;
+    scaler->next_query = 0;
+
+    scaler->target_ms = RESOLUTION_TARGET_MS;
+    scaler->gpu_ms = 0.0;
+    scaler->last_gpu_ms = 0.0;
+    scaler->frames_since_change = 0;
+    scaler->settle_frames = 0;
+    scaler->last_decision = RESOLUTION_HOLD;
+    scaler->scale_downs = scaler->scale_ups = 0;
+
+    if (!scaler->timed)
+        fprintf(stderr, "No GL_ARB_timer_query: rendering at a fixed scale\n");
+    return GL_TRUE;
+}
+
+void resolution_destroy(struct resolution_scaler *scaler) {
+    glDeleteFramebuffers(1, &scaler->scene_fbo);
+    glDeleteRenderbuffers(1, &scaler->scene_colour);
+    glDeleteRenderbuffers(1, &scaler->scene_depth);
+    glDeleteFramebuffers(1, &scaler->resolve_fbo);  /* 0 is ignored */
+    glDeleteRenderbuffers(1, &scaler->resolve_colour);
+    if (scaler->timed)
+        glDeleteQueries(RESOLUTION_QUERY_RING, scaler->queries);
+
+    scaler->scene_fbo = scaler->scene_colour = scaler->scene_depth = 0;
+    scaler->resolve_fbo = scaler->resolve_colour = 0;
+}
+
+/* feed one GPU frame time to the controller; returns what it decided */
+enum resolution_decision resolution_update(struct resolution_scaler *scaler,
+                                           GLdouble gpu_ms) {
+    scaler->last_gpu_ms = gpu_ms;
+    scaler->frames_since_change += 1;
+
+    /* frames already in flight when the scale changed still show the old cost */
+    if (scaler->settle_frames > 0) {
+        scaler->settle_frames -= 1;
+        return RESOLUTION_HOLD;
+    }
+
+    if (scaler->gpu_ms == 0.0)
+        scaler->gpu_ms = gpu_ms;
+    else
+        scaler->gpu_ms += RESOLUTION_SMOOTHING * (gpu_ms - scaler->gpu_ms);
+
+    enum resolution_decision decision = RESOLUTION_HOLD;
+    GLfloat scale = scaler->scale;
+
+    if (scaler->gpu_ms > scaler->target_ms && scale > RESOLUTION_MIN_SCALE) {
+        scale *= (GLfloat)sqrt(scaler->target_ms * RESOLUTION_DOWN_AIM / scaler->gpu_ms);
+        decision = RESOLUTION_DOWN;
+    }
+    else if (scaler->gpu_ms < scaler->target_ms * RESOLUTION_HEADROOM
+             && scaler->frames_since_change >= RESOLUTION_UP_COOLDOWN
+             && scale < RESOLUTION_MAX_SCALE) {
+        scale += RESOLUTION_UP_STEP;
+        decision = RESOLUTION_UP;
+    }
+
+    if (decision == RESOLUTION_HOLD)
+        return decision;
+
+    GLuint old_width = scaler->render_width, old_height = scaler->render_height;
+    resolution_set_scale(scaler, scale);
+    if (scaler->render_width == old_width && scaler->render_height == old_height)
+        return RESOLUTION_HOLD;     /* below the alignment granularity */
+
+    if (scaler->log_decisions)
+        fprintf(stderr, "resolution: %s to %.2f (%ux%u), gpu %.2f ms avg, target %.2f ms\n",
+                resolution_decision_names[decision], scaler->scale,
+                scaler->render_width, scaler->render_height,
+                scaler->gpu_ms, scaler->target_ms);
+
+    if (decision == RESOLUTION_DOWN)
+        scaler->scale_downs += 1;
+    else
+        scaler->scale_ups += 1;
+    scaler->last_decision = decision;
+    scaler->frames_since_change = 0;
+    scaler->settle_frames = RESOLUTION_QUERY_RING;
+    scaler->gpu_ms = 0.0;   /* start averaging afresh at the new size */
+
+    return decision;
+}
+
+/* read back finished timer queries, oldest first, without waiting */
+static void resolution_collect(struct resolution_scaler *scaler) {
+    GLuint i;
+    for (i = 0; i < RESOLUTION_QUERY_RING; i++) {
+        GLuint slot = (scaler->next_query + i) % RESOLUTION_QUERY_RING;
+        if (!scaler->query_pending[slot])
+            continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(scaler->queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint64 elapsed_ns;
+        glGetQueryObjectui64v(scaler->queries[slot], GL_QUERY_RESULT, &elapsed_ns);
+        scaler->query_pending[slot] = GL_FALSE;
+        resolution_update(scaler, elapsed_ns / 1e6);
+    }
+}
+
+/* redirect drawing to the offscreen target, at the current render size */
+void resolution_begin_frame(struct resolution_scaler *scaler) {
+    if (scaler->timed) {
+        /* ring full: this one is old enough that waiting for it is cheap */
+        if (scaler->query_pending[scaler->next_query]) {
+            GLuint64 elapsed_ns;
+            glGetQueryObjectui64v(scaler->queries[scaler->next_query], GL_QUERY_RESULT, &elapsed_ns);
+            scaler->query_pending[scaler->next_query] = GL_FALSE;
+            resolution_update(scaler, elapsed_ns / 1e6);
+        }
+        glBeginQuery(GL_TIME_ELAPSED, scaler->queries[scaler->next_query]);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scaler->scene_fbo);
+    glViewport(0, 0, scaler->render_width, scaler->render_height);
+
+    /* so clears only touch the part in use */
+    glScissor(0, 0, scaler->render_width, scaler->render_height);
+    glEnable(GL_SCISSOR_TEST);
+}
+
+/* resolve & upscale to the window, then feed the controller */
+void resolution_end_frame(struct resolution_scaler *scaler) {
+    GLint width = scaler->render_width, height = scaler->render_height;
+
+    glDisable(GL_SCISSOR_TEST);    /* blits are scissored too */
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scaler->scene_fbo);
+    if (scaler->samples) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scaler->resolve_fbo);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, scaler->resolve_fbo);
+    }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height,
+                      0, 0, scaler->window_width, scaler->window_height,
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, scaler->window_width, scaler->window_height);
+
+    if (scaler->timed) {
+        glEndQuery(GL_TIME_ELAPSED);
+        scaler->query_pending[scaler->next_query] = GL_TRUE;
+        scaler->next_query = (scaler->next_query + 1) % RESOLUTION_QUERY_RING;
+        resolution_collect(scaler);
+    }
+}
+
+void resolution_report(const struct resolution_scaler *scaler,
+                       FILE *out) {
+    fprintf(out, "resolution: scale %.2f (%ux%u of %ux%u), gpu %.2f ms (avg %.2f), target %.2f ms, "
+                 "last decision %s, %u down / %u up%s\n",
+            scaler->scale, scaler->render_width, scaler->render_height,
+            scaler->window_width, scaler->window_height,
+            scaler->last_gpu_ms, scaler->gpu_ms, scaler->target_ms,
+            resolution_decision_names[scaler->last_decision],
+            scaler->scale_downs, scaler->scale_ups,
+            scaler->timed ? "" : " (no timer queries)");
+}
@@ -0,0 +1,69 @@
+#define RESOLUTION_QUERY_RING 4         /* GPU timer queries in flight */
+#define RESOLUTION_TARGET_MS 14.0       /* GPU time budget per frame, with headroom under 60Hz */
+#define RESOLUTION_MIN_SCALE 0.5
+#define RESOLUTION_MAX_SCALE 1.0
+#define RESOLUTION_DOWN_AIM 0.9         /* scaling down aims this far under budget, to absorb noise */
+#define RESOLUTION_HEADROOM 0.75        /* only scale up while under this fraction of the budget */
+#define RESOLUTION_SMOOTHING 0.2        /* weight of the newest sample in the moving average */
+#define RESOLUTION_UP_STEP 0.05         /* scale up slowly... */
+#define RESOLUTION_UP_COOLDOWN 30       /* ...and only after this many frames without a change */
+#define RESOLUTION_ALIGN 8              /* render size is a multiple of this many pixels */
+
+enum resolution_decision {
+    RESOLUTION_HOLD,
+    RESOLUTION_DOWN,
+    RESOLUTION_UP
+};
+
+/* structure definitions */
+
+/* the 3D scene is drawn into an offscreen framebuffer covering scale x the
+ * window, then upscaled to the window with a filtered blit. The scale
+ * follows measured GPU time to keep frames within target_ms */
+struct resolution_scaler {
+    GLuint window_width, window_height;
+    GLuint render_width, render_height;
+    GLfloat scale;
+
+    /* multisampled scene target (allocated at window size; only the
+     * render_width x render_height corner is used) & its resolve target */
+    GLuint samples;
+    GLuint scene_fbo, scene_colour, scene_depth;
+    GLuint resolve_fbo, resolve_colour;
+
+    GLboolean timed;                /* GL_ARB_timer_query available */
+    GLuint queries[RESOLUTION_QUERY_RING];
+    GLboolean query_pending[RESOLUTION_QUERY_RING];
+    GLuint next_query;
+
+    /* controller */
+    GLdouble target_ms;
+    GLdouble gpu_ms;                /* moving average */
+    GLdouble last_gpu_ms;
+    GLuint frames_since_change;
+    GLuint settle_frames;           /* samples still measured at the old scale */
+
+    /* instrumentation */
+    enum resolution_decision last_decision;
+    GLuint scale_downs;
+    GLuint scale_ups;
+    GLboolean log_decisions;
+};
+
+/* function prototypes */
+GLboolean resolution_init(struct resolution_scaler *scaler,
+                          GLuint window_width,
+                          GLuint window_height,
+                          GLuint samples);
+void resolution_destroy(struct resolution_scaler *scaler);
+
+void resolution_begin_frame(struct resolution_scaler *scaler);
+void resolution_end_frame(struct resolution_scaler *scaler);
+
+enum resolution_decision resolution_update(struct resolution_scaler *scaler,
+                                           GLdouble gpu_ms);
+void resolution_set_scale(struct resolution_scaler *scaler,
+                          GLfloat scale);
+
+void resolution_report(const struct resolution_scaler *scaler,
+                       FILE *out);
@@ -0,0 +1,520 @@
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <GL/glfw.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "util.h"
+#include "mesh_arena.h"
+#include "texture_array.h"
+#include "resources.h"
+
+using namespace std;
+
+/*
+ * Shared GPU resources: loading the same mesh, texture, shader or program
+ * twice hands back the same GL objects, which are deleted as soon as the
+ * last handle to them is released.
+ */
+
+static const char *resource_type_names[RESOURCE_TYPE_COUNT] = {
+    "mesh", "texture", "shader", "program"
+};
+
+/* look up an existing resource by content; takes a reference on a hit */
+static GLuint resource_find(struct resource_manager *manager,
+                            enum resource_type type,
+                            GLuint64 hash) {
+    map<pair<GLuint, GLuint64>, GLuint>::iterator it = manager->by_hash.find(make_pair((GLuint)type, hash));
+    if (it == manager->by_hash.end())
+        return 0;
+
+    manager->entries[it->second - 1].refs += 1;
+    return it->second;
+}
+
+/* store a newly created resource (with one reference) and return its handle */
+static GLuint resource_add(struct resource_manager *manager,
+                           struct resource *res) {
+    GLuint slot;
+    for (slot = 0; slot < manager->entries.size(); slot++) {
+        if (manager->entries[slot].refs == 0)
+            break;
+    }
+    if (slot == manager->entries.size())
+        manager->entries.push_back(*res);
+    else
+        manager->entries[slot] = *res;
+
+    manager->entries[slot].refs = 1;
+    manager->by_hash[make_pair((GLuint)res->type, res->hash)] = slot + 1;
+    manager->live_count[res->type] += 1;
+    manager->live_bytes[res->type] += res->bytes;
+
+    return slot + 1;
+}
+
+/* hash of a file's contents; GL_FALSE if it can't be read */
+static GLboolean hash_file(const char *path, GLuint64 *hash) {
+    GLint length;
+    void *contents = file_contents(path, &length);
+    if (!contents)
+        return GL_FALSE;
+
+    *hash = hash_bytes(contents, length, HASH_SEED);
+    free(contents);
+    return GL_TRUE;
+}
+
+/* put an .obj mesh into the arena (res->path, res->has_texture set);
+ * `mesh` is the file already parsed by the caller, or NULL to parse it */
+static GLboolean mesh_create(struct resource_manager *manager,
+                             struct resource *res,
+                             const struct mesh_data *mesh) {
+    struct mesh_data parsed;
+    if (!mesh) {
+        if (!load_mesh(res->path.c_str(), &parsed, res->has_texture))
+            return GL_FALSE;
+        mesh = &parsed;
+    }
+
+    if (mesh->vertices.empty() || mesh->elements.empty()) {
+        fprintf(stderr, "No geometry in %s\n", res->path.c_str());
+        return GL_FALSE;
+    }
+
+    if (!mesh_arena_add(&manager->arena, mesh, &res->first_vertex, &res->first_index)) {
+        fprintf(stderr, "No room in the mesh arena for %s\n", res->path.c_str());
+        return GL_FALSE;
+    }
+
+    res->object = manager->arena.vao;
+    res->num_vertices = (GLuint)mesh->vertices.size();
+    res->num_elements = mesh->elements.size();
+
+    res->bytes = (sizeof(struct arena_vertex) + sizeof(glm::vec4)) * mesh->vertices.size()
+               + sizeof(GLushort) * mesh->elements.size();
+
+    return GL_TRUE;
+}
+
+/* an .obj mesh, suballocated from the shared arena. `mesh` may be the
+ * file as the caller has already parsed it (it isn't kept), else NULL */
+GLuint resource_mesh(struct resource_manager *manager,
+                     const char *obj_path,
+                     GLboolean has_texture,
+                     const struct mesh_data *mesh) {
+    GLuint64 hash;
+    if (!hash_file(obj_path, &hash))
+        return 0;
+    hash = hash_bytes(&has_texture, sizeof(has_texture), hash);
+
+    GLuint handle = resource_find(manager, RESOURCE_MESH, hash);
+    if (handle)
+        return handle;
+
+    struct resource res = resource();
+    res.type = RESOURCE_MESH;
+    res.path = obj_path;
+    res.hash = hash;
+    res.has_texture = has_texture;
+
+    if (!mesh_create(manager, &res, mesh))
+        return 0;
+
+    return resource_add(manager, &res);
+}
+
+/* load a texture file into a new GL texture (res->path set) */
+static GLboolean texture_create(struct resource *res) {
+    glGenTextures(1, &res->object);
+    glBindTexture(GL_TEXTURE_2D, res->object);
+    if (!glfwLoadTexture2D(res->path.c_str(), 0)) {
+        fprintf(stderr, "Unable to load texture %s\n", res->path.c_str());
+        glDeleteTextures(1, &res->object);
+        return GL_FALSE;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    /* drivers store RGB as 4 bytes per texel, so count everything as RGBA8 */
+    GLint width, height;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    res->bytes = (GLulong)width * height * 4;
+
+    return GL_TRUE;
+}
+
+/* 2D texture loaded through glfw */
+GLuint resource_texture(struct resource_manager *manager,
+                        const char *texture_path) {
+    GLuint64 hash;
+    if (!hash_file(texture_path, &hash))
+        return 0;
+
+    GLuint handle = resource_find(manager, RESOURCE_TEXTURE, hash);
+    if (handle)
+        return handle;
+
+    struct resource res = resource();
+    res.type = RESOURCE_TEXTURE;
+    res.path = texture_path;
+    res.hash = hash;
+
+    if (!texture_create(&res))
+        return 0;
+
+    return resource_add(manager, &res);
+}
+
+/* compiled shader object; bytes counts the source, not driver memory */
+GLuint resource_shader(struct resource_manager *manager,
+                       GLenum shader_type,
+                       const char *shader_path) {
+    GLint length;
+    GLchar *source = (GLchar *)file_contents(shader_path, &length);
+    if (!source)
+        return 0;
+
+    GLuint64 hash = hash_bytes(source, length, HASH_SEED);
+    hash = hash_bytes(&shader_type, sizeof(shader_type), hash);
+
+    GLuint handle = resource_find(manager, RESOURCE_SHADER, hash);
+    if (handle) {
+        free(source);
+        return handle;
+    }
+
+    struct resource res = resource();
+    res.type = RESOURCE_SHADER;
+    res.path = shader_path;
+    res.hash = hash;
+    res.shader_type = shader_type;
+
+    res.object = make_shader(shader_type, source, length, shader_path);
+    free(source);
+    if (res.object == 0)
+        return 0;
+    res.bytes = length;
+
+    return resource_add(manager, &res);
+}
+
+/* linked program; keyed by the shaders it is made from, which it keeps
+ * a reference on */
+GLuint resource_program(struct resource_manager *manager,
+                        const char *vertex_shader_path,
+                        const char *fragment_shader_path) {
+    GLuint vertex_shader = resource_shader(manager, GL_VERTEX_SHADER, vertex_shader_path);
+    if (vertex_shader == 0)
+        return 0;
+
+    GLuint fragment_shader = resource_shader(manager, GL_FRAGMENT_SHADER, fragment_shader_path);
+    if (fragment_shader == 0) {
+        resource_release(manager, vertex_shader);
+        return 0;
+    }
+
+    GLuint64 hash = hash_bytes(&manager->entries[vertex_shader - 1].hash, sizeof(GLuint64), HASH_SEED);
+    hash = hash_bytes(&manager->entries[fragment_shader - 1].hash, sizeof(GLuint64), hash);
+
+    GLuint handle = resource_find(manager, RESOURCE_PROGRAM, hash);
+    if (handle) {
+        /* existing program already holds references on these shaders */
+        resource_release(manager, vertex_shader);
+        resource_release(manager, fragment_shader);
+        return handle;
+    }
+
+    struct resource res = resource();
+    res.type = RESOURCE_PROGRAM;
+    res.path = string(vertex_shader_path) + "+" + fragment_shader_path;
+    res.hash = hash;
+    res.shaders[0] = vertex_shader;
+    res.shaders[1] = fragment_shader;
+
+    res.object = make_program(manager->entries[vertex_shader - 1].object,
+                              manager->entries[fragment_shader - 1].object);
+    if (res.object == 0) {
+        resource_release(manager, vertex_shader);
+        resource_release(manager, fragment_shader);
+        return 0;
+    }
+
+    return resource_add(manager, &res);
+}
+
+const struct resource *resource_get(const struct resource_manager *manager,
+                                    GLuint handle) {
+    if (handle == 0 || handle > manager->entries.size() || manager->entries[handle - 1].refs == 0)
+        return NULL;
+
+    return &manager->entries[handle - 1];
+}
+
+/* delete the GL objects behind a resource */
+static void resource_delete(struct resource_manager *manager,
+                            struct resource *res) {
+    switch (res->type) {
+        case RESOURCE_MESH:
+            mesh_arena_remove(&manager->arena, res->first_vertex, res->num_vertices,
+                              res->first_index, (GLuint)res->num_elements);
+            break;
+        case RESOURCE_TEXTURE:
+            glDeleteTextures(1, &res->object);
+            break;
+        case RESOURCE_SHADER:
+            glDeleteShader(res->object);
+            break;
+        case RESOURCE_PROGRAM:
+            glDeleteProgram(res->object);
+            break;
+        default:
+            break;
+    }
+}
+
+/* drop one reference; the last one deletes the GL objects immediately */
+void resource_release(struct resource_manager *manager,
+                      GLuint handle) {
+    if (!resource_get(manager, handle))
+        return;
+
+    struct resource *res = &manager->entries[handle - 1];
+    res->refs -= 1;
+    if (res->refs > 0)
+        return;
+
+    /* after a reload, another resource may be the dedup target for this hash */
+    map<pair<GLuint, GLuint64>, GLuint>::iterator it = manager->by_hash.find(make_pair((GLuint)res->type, res->hash));
+    if (it != manager->by_hash.end() && it->second == handle)
+        manager->by_hash.erase(it);
+
+    resource_delete(manager, res);
+    manager->reloaded_meshes.erase(handle);
+    manager->live_count[res->type] -= 1;
+    manager->live_bytes[res->type] -= res->bytes;
+
+    GLuint shaders[2] = { res->shaders[0], res->shaders[1] };
+    *res = resource();
+
+    /* programs hold references on their shaders */
+    resource_release(manager, shaders[0]);
+    resource_release(manager, shaders[1]);
+}
+
+/* swap a re-created resource's GL objects in under the same handle, so
+ * existing references see the new version; the old objects are deleted */
+static void resource_replace(struct resource_manager *manager,
+                             GLuint handle,
+                             struct resource *fresh) {
+    struct resource *res = &manager->entries[handle - 1];
+
+    map<pair<GLuint, GLuint64>, GLuint>::iterator it = manager->by_hash.find(make_pair((GLuint)res->type, res->hash));
+    if (it != manager->by_hash.end() && it->second == handle)
+        manager->by_hash.erase(it);
+
+    resource_delete(manager, res);
+    manager->live_bytes[res->type] -= res->bytes;
+    manager->live_bytes[res->type] += fresh->bytes;
+
+    fresh->refs = res->refs;
+    *res = *fresh;
+
+    /* if identical content is already loaded elsewhere, leave that as the dedup target */
+    if (!manager->by_hash.count(make_pair((GLuint)res->type, res->hash)))
+        manager->by_hash[make_pair((GLuint)res->type, res->hash)] = handle;
+}
+
+/* relink every program using a shader that was just recompiled */
+static GLuint resource_relink_programs(struct resource_manager *manager,
+                                       GLuint shader) {
+    GLuint relinked = 0;
+    GLuint i;
+
+    for (i = 0; i < manager->entries.size(); i++) {
+        struct resource *res = &manager->entries[i];
+        if (res->refs == 0 || res->type != RESOURCE_PROGRAM)
+            continue;
+        if (res->shaders[0] != shader && res->shaders[1] != shader)
+            continue;
+
+        struct resource fresh = *res;
+        fresh.object = make_program(manager->entries[res->shaders[0] - 1].object,
+                                    manager->entries[res->shaders[1] - 1].object);
+        if (fresh.object == 0) {
+            fprintf(stderr, "Keeping previous version of program %s\n", res->path.c_str());
+            continue;
+        }
+
+        fresh.hash = hash_bytes(&manager->entries[res->shaders[0] - 1].hash, sizeof(GLuint64), HASH_SEED);
+        fresh.hash = hash_bytes(&manager->entries[res->shaders[1] - 1].hash, sizeof(GLuint64), fresh.hash);
+        resource_replace(manager, i + 1, &fresh);
+        relinked += 1;
+    }
+
+    return relinked;
+}
+
+/* re-create one resource from its source file. On any failure (missing
+ * file, compile error, ...) the previous version stays in use.
+ * Returns the number of resources replaced (a shader also relinks its programs) */
+static GLuint resource_reload(struct resource_manager *manager,
+                              GLuint handle) {
+    struct resource *res = &manager->entries[handle - 1];
+    struct resource fresh = *res;
+    fresh.object = 0;
+
+    switch (res->type) {
+        case RESOURCE_MESH: {
+            if (!hash_file(res->path.c_str(), &fresh.hash))
+                return 0;
+            fresh.hash = hash_bytes(&fresh.has_texture, sizeof(fresh.has_texture), fresh.hash);
+            if (fresh.hash == res->hash)
+                return 0;
+
+            struct mesh_data mesh;
+            if (!load_mesh(res->path.c_str(), &mesh, res->has_texture)
+                || !mesh_create(manager, &fresh, &mesh)) {
+                fprintf(stderr, "Keeping previous version of %s\n", res->path.c_str());
+                return 0;
+            }
+
+            /* whoever keeps a CPU copy can take this one, not parse again */
+            swap(manager->reloaded_meshes[handle], mesh);
+            break;
+        }
+
+        case RESOURCE_TEXTURE:
+            if (!hash_file(res->path.c_str(), &fresh.hash))
+                return 0;
+            if (fresh.hash == res->hash || !texture_create(&fresh))
+                return 0;
+            break;
+
+        case RESOURCE_SHADER: {
+            GLint length;
+            GLchar *source = (GLchar *)file_contents(res->path.c_str(), &length);
+            if (!source)
+                return 0;
+
+            fresh.hash = hash_bytes(source, length, HASH_SEED);
+            fresh.hash = hash_bytes(&fresh.shader_type, sizeof(fresh.shader_type), fresh.hash);
+            if (fresh.hash == res->hash) {
+                free(source);
+                return 0;
+            }
+
+            fresh.object = make_shader(fresh.shader_type, source, length, res->path.c_str());
+            free(source);
+            if (fresh.object == 0) {
+                fprintf(stderr, "Keeping previous version of %s\n", res->path.c_str());
+                return 0;
+            }
+            fresh.bytes = length;
+
+            resource_replace(manager, handle, &fresh);
+            return 1 + resource_relink_programs(manager, handle);
+        }
+
+        default:    /* programs are relinked through their shaders */
+            return 0;
+    }
+
+    resource_replace(manager, handle, &fresh);
+    return 1;
+}
+
+/* the mesh behind `handle` as its last reload parsed it, into *mesh (GL_TRUE);
+ * GL_FALSE if it hasn't been reloaded since it was created or last taken */
+GLboolean resource_take_reloaded_mesh(struct resource_manager *manager,
+                                      GLuint handle,
+                                      struct mesh_data *mesh) {
+    map<GLuint, struct mesh_data>::iterator it = manager->reloaded_meshes.find(handle);
+    if (it == manager->reloaded_meshes.end())
+        return GL_FALSE;
+
+    swap(*mesh, it->second);
+    manager->reloaded_meshes.erase(it);
+    return GL_TRUE;
+}
+
+/* reload every live resource (and texture array layer) loaded from `path`;
+ * returns how many were replaced */
+GLuint resource_reload_path(struct resource_manager *manager,
+                            const char *path) {
+    GLuint reloaded = 0;
+    GLuint i;
+
+    for (i = 0; i < manager->entries.size(); i++) {
+        if (manager->entries[i].refs > 0
+            && manager->entries[i].type != RESOURCE_PROGRAM
+            && manager->entries[i].path == path)
+            reloaded += resource_reload(manager, i + 1);
+    }
+    reloaded += texture_arrays_reload_path(&manager->arrays, path);
+
+    return reloaded;
+}
+
+/* live resource counts & bytes per category */
+void resource_manager_report(const struct resource_manager *manager,
+                             FILE *out) {
+    int type;
+    GLulong total = 0;
+
+    fprintf(out, "resources:");
+    for (type = 0; type < RESOURCE_TYPE_COUNT; type++) {
+        fprintf(out, " %s %u (%lu bytes)%s",
+                resource_type_names[type],
+                manager->live_count[type],
+                manager->live_bytes[type],
+                (type < RESOURCE_TYPE_COUNT - 1) ? "," : "\n");
+        total += manager->live_bytes[type];
+    }
+    fprintf(out, "resources: %lu bytes total\n", total);
+}
+
+/* needs a GL context (creates the mesh arena's buffers) */
+void resource_manager_init(struct resource_manager *manager) {
+    mesh_arena_init(&manager->arena);
+}
+
+/* delete everything still alive (call before the GL context goes away) */
+void resource_manager_destroy(struct resource_manager *manager) {
+    GLuint leaked = 0;
+    GLuint i;
+
+    for (i = 0; i < manager->entries.size(); i++) {
+        if (manager->entries[i].refs == 0)
+            continue;
+
+        resource_delete(manager, &manager->entries[i]);
+        leaked += 1;
+    }
+
+    if (leaked > 0)
+        fprintf(stderr, "%u resources still referenced at shutdown\n", leaked);
+
+    mesh_arena_destroy(&manager->arena);
+    texture_arrays_destroy(&manager->arrays);
+    manager->entries.clear();
+    manager->by_hash.clear();
+    manager->reloaded_meshes.clear();
+    int type;
+    for (type = 0; type < RESOURCE_TYPE_COUNT; type++) {
+        manager->live_count[type] = 0;
+        manager->live_bytes[type] = 0;
+    }
+}
@@ -0,0 +1,80 @@
+enum resource_type {
+    RESOURCE_MESH,
+    RESOURCE_TEXTURE,
+    RESOURCE_SHADER,
+    RESOURCE_PROGRAM,
+    RESOURCE_TYPE_COUNT
+};
+
+/* structure definitions */
+struct resource {
+    enum resource_type type;
+    std::string path;           /* source file(s), for reporting & reloading */
+    GLuint64 hash;              /* content hash the resource is keyed by */
+    GLuint refs;                /* 0 = free slot */
+
+    GLuint object;              /* VAO (the arena's, for meshes), texture, shader or program name */
+
+    /* meshes only: where the mesh lives in the arena */
+    GLuint first_vertex;
+    GLuint num_vertices;
+    GLuint first_index;
+    GLulong num_elements;
+    GLboolean has_texture;
+
+    /* shaders only */
+    GLenum shader_type;
+
+    /* programs only: handles of the shaders they were linked from */
+    GLuint shaders[2];
+
+    GLulong bytes;              /* GPU memory (or source size, for shaders) */
+};
+
+/* shared GPU resources, deduplicated by type + content hash, with
+ * reference-counted handles (index + 1 into entries; 0 is never valid) */
+struct resource_manager {
+    struct mesh_arena arena;    /* all meshes' vertices & indices */
+    struct texture_arrays arrays;   /* textures of models drawn with a sampler2DArray */
+
+    std::vector<struct resource> entries;
+    std::map<std::pair<GLuint, GLuint64>, GLuint> by_hash;
+
+    /* meshes as a reload just parsed them, by handle, until taken with
+     * resource_take_reloaded_mesh */
+    std::map<GLuint, struct mesh_data> reloaded_meshes;
+
+    GLuint live_count[RESOURCE_TYPE_COUNT];
+    GLulong live_bytes[RESOURCE_TYPE_COUNT];
+};
+
+/* function prototypes */
+void resource_manager_init(struct resource_manager *manager);
+
+GLuint resource_mesh(struct resource_manager *manager,
+                     const char *obj_path,
+                     GLboolean has_texture,
+                     const struct mesh_data *mesh);
+GLuint resource_texture(struct resource_manager *manager,
+                        const char *texture_path);
+GLuint resource_shader(struct resource_manager *manager,
+                       GLenum shader_type,
+                       const char *shader_path);
+GLuint resource_program(struct resource_manager *manager,
+                        const char *vertex_shader_path,
+                        const char *fragment_shader_path);
+
+const struct resource *resource_get(const struct resource_manager *manager,
+                                    GLuint handle);
+void resource_release(struct resource_manager *manager,
+                      GLuint handle);
+
+GLuint resource_reload_path(struct resource_manager *manager,
+                            const char *path);
+GLboolean resource_take_reloaded_mesh(struct resource_manager *manager,
+                                      GLuint handle,
+                                      struct mesh_data *mesh);
+
+void resource_manager_report(const struct resource_manager *manager,
+                             FILE *out);
+void resource_manager_destroy(struct resource_manager *manager);
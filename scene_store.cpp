@@ -0,0 +1,140 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "scene_store.h"
+
+using namespace std;
+
+/*
+ * Scene object transforms, kept as parallel arrays so the per-frame update
+ * walks contiguous memory and only touches entities whose transform (or an
+ * ancestor's) changed since the last update.
+ */
+
+void scene_store_reserve(struct scene_store *store, GLuint count) {
+    store->positions.reserve(count);
+    store->rotations.reserve(count);
+    store->scales.reserve(count);
+    store->parents.reserve(count);
+    store->dirty.reserve(count);
+    store->world_matrices.reserve(count);
+    store->normal_matrices.reserve(count);
+}
+
+/* add an entity with an identity transform; parent must already exist */
+GLuint scene_store_create(struct scene_store *store, GLuint parent) {
+    GLuint entity = store->count;
+
+    if (parent != SCENE_NO_PARENT && parent >= entity) {
+        fprintf(stderr, "Entity parent %u does not exist\n", parent);
+        parent = SCENE_NO_PARENT;
+    }
+
+    store->positions.push_back(glm::vec3(0.0));
+    store->rotations.push_back(glm::vec3(0.0));
+    store->scales.push_back(glm::vec3(1.0));
+    store->parents.push_back(parent);
+    store->dirty.push_back(GL_TRUE);
+    store->world_matrices.push_back(glm::mat4(1.0));
+    store->normal_matrices.push_back(glm::mat3(1.0));
+
+    store->count += 1;
+    return entity;
+}
+
+void scene_store_set_position(struct scene_store *store, GLuint entity, glm::vec3 position) {
+    store->positions[entity] = position;
+    store->dirty[entity] = GL_TRUE;
+}
+
+void scene_store_set_rotation(struct scene_store *store, GLuint entity, glm::vec3 rotation) {
+    store->rotations[entity] = rotation;
+    store->dirty[entity] = GL_TRUE;
+}
+
+void scene_store_set_scale(struct scene_store *store, GLuint entity, glm::vec3 scale) {
+    store->scales[entity] = scale;
+    store->dirty[entity] = GL_TRUE;
+}
+
+/* world-space origin of an entity, as of the last update */
+glm::vec3 scene_store_world_position(const struct scene_store *store, GLuint entity) {
+    return glm::vec3(store->world_matrices[entity][3]);
+}
+
+/* local matrix from translation, euler rotation (Ry * Rx * Rz) and scale,
+ * written out directly rather than multiplying three rotation matrices */
+static inline glm::mat4 local_matrix(glm::vec3 position,
+                                     glm::vec3 rotation,
+                                     glm::vec3 scale) {
+    GLfloat sx = sinf(rotation.x), cx = cosf(rotation.x);
+    GLfloat sy = sinf(rotation.y), cy = cosf(rotation.y);
+    GLfloat sz = sinf(rotation.z), cz = cosf(rotation.z);
+
+    glm::mat4 m;
+    m[0] = glm::vec4(cy * cz + sy * sx * sz, cx * sz, -sy * cz + cy * sx * sz, 0.0) * scale.x;
+    m[1] = glm::vec4(-cy * sz + sy * sx * cz, cx * cz, sy * sz + cy * sx * cz, 0.0) * scale.y;
+    m[2] = glm::vec4(sy * cx, -sx, cy * cx, 0.0) * scale.z;
+    m[3] = glm::vec4(position, 1.0);
+
+    return m;
+}
+
+/* inverse-transpose of the upper 3x3: columns are cross products of the
+ * other two columns over the determinant (cheaper than a general inverse) */
+static inline glm::mat3 normal_matrix(const glm::mat4 &m) {
+    glm::vec3 a = glm::vec3(m[0]);
+    glm::vec3 b = glm::vec3(m[1]);
+    glm::vec3 c = glm::vec3(m[2]);
+
+    glm::vec3 bc = glm::cross(b, c);
+    GLfloat inv_det = 1.0f / glm::dot(a, bc);
+
+    glm::mat3 n;
+    n[0] = bc * inv_det;
+    n[1] = glm::cross(c, a) * inv_det;
+    n[2] = glm::cross(a, b) * inv_det;
+
+    return n;
+}
+
+/* recompute world & normal matrices of changed entities and their
+ * descendants; returns the number of entities recomputed */
+GLuint scene_store_update(struct scene_store *store) {
+    GLuint updated = 0;
+    GLuint i;
+
+    for (i = 0; i < store->count; i++) {
+        GLuint parent = store->parents[i];
+
+        /* a parent's change propagates down: parents come first, so their flag is final */
+        if (parent != SCENE_NO_PARENT && store->dirty[parent])
+            store->dirty[i] = GL_TRUE;
+
+        if (!store->dirty[i])
+            continue;
+
+        glm::mat4 local = local_matrix(store->positions[i],
+                                       store->rotations[i],
+                                       store->scales[i]);
+
+        if (parent != SCENE_NO_PARENT)
+            store->world_matrices[i] = store->world_matrices[parent] * local;
+        else
+            store->world_matrices[i] = local;
+
+        store->normal_matrices[i] = normal_matrix(store->world_matrices[i]);
+        updated += 1;
+    }
+
+    if (updated > 0)
+        memset(&store->dirty[0], GL_FALSE, store->count);
+
+    return updated;
+}
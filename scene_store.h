@@ -0,0 +1,36 @@
+#define SCENE_NO_PARENT 0xFFFFFFFFu
+
+/* entity/component store for scene objects: one entry per entity in each
+ * array (structure of arrays), indexed by entity id.
+ * Parents are always created before their children, so a single pass in id
+ * order sees every parent's world matrix before it is needed. */
+struct scene_store {
+    GLuint count;
+
+    /* local transform, relative to the parent (or world if no parent) */
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> rotations;   /* euler angles, radians: applied z, x, then y */
+    std::vector<glm::vec3> scales;
+
+    /* hierarchy */
+    std::vector<GLuint> parents;
+
+    /* set when the local transform changes; cleared by scene_store_update */
+    std::vector<GLubyte> dirty;
+
+    /* cached results of scene_store_update */
+    std::vector<glm::mat4> world_matrices;
+    std::vector<glm::mat3> normal_matrices;   /* inverse-transpose of world's upper 3x3 */
+};
+
+/* function prototypes */
+GLuint scene_store_create(struct scene_store *store, GLuint parent);
+void scene_store_reserve(struct scene_store *store, GLuint count);
+
+void scene_store_set_position(struct scene_store *store, GLuint entity, glm::vec3 position);
+void scene_store_set_rotation(struct scene_store *store, GLuint entity, glm::vec3 rotation);
+void scene_store_set_scale(struct scene_store *store, GLuint entity, glm::vec3 scale);
+
+glm::vec3 scene_store_world_position(const struct scene_store *store, GLuint entity);
+
+GLuint scene_store_update(struct scene_store *store);
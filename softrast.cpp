@@ -0,0 +1,644 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "util.h"
+#include "thread_pool.h"
+#include "softrast.h"
+
+using namespace std;
+
+/*
+ * CPU rendering backend, for machines without a GPU. Same pipeline shape
+ * as the GL path: vertex transform, near-plane clipping, then triangles are
+ * binned into screen tiles and each tile is rasterized (edge functions, 4
+ * pixels at a time) and shaded independently on the thread pool.
+ * Shading is the ambient + diffuse model of frag.glsl, modulating the
+ * texture when there is one (as frag_baked.glsl does).
+ */
+
+/* same material colour as frag.glsl */
+static const glm::vec3 softrast_material_diffuse = glm::vec3(1.0, 0.8, 0.8);
+
+void softrast_target_resize(struct softrast_target *target,
+                            GLuint width,
+                            GLuint height) {
+    target->width = width;
+    target->height = height;
+    target->stride = (width + 3) & ~3u;
+    target->colour.assign((size_t)target->stride * height, 0);
+    target->depth.assign((size_t)target->stride * height, 1.0f);
+}
+
+static inline GLuint pack_colour(glm::vec4 colour) {
+    colour = glm::clamp(colour, 0.0f, 1.0f);
+    return (GLuint)(colour.x * 255.0f + 0.5f)
+         | (GLuint)(colour.y * 255.0f + 0.5f) << 8
+         | (GLuint)(colour.z * 255.0f + 0.5f) << 16
+         | (GLuint)(colour.w * 255.0f + 0.5f) << 24;
+}
+
+void softrast_clear(struct softrast_target *target,
+                    glm::vec4 colour) {
+    fill(target->colour.begin(), target->colour.end(), pack_colour(colour));
+    fill(target->depth.begin(), target->depth.end(), 1.0f);
+}
+
+/*
+ * vertex stage
+ */
+
+static void softrast_transform_vertices(void *data, GLuint begin, GLuint end) {
+    struct softrast_context *context = (struct softrast_context *)data;
+
+    GLuint model_idx = 0;
+    GLuint v;
+    for (v = begin; v < end; v++) {
+        while (model_idx + 1 < context->num_models && v >= context->first_vertex[model_idx + 1])
+            model_idx += 1;
+
+        const struct softrast_model *model = &context->models[model_idx];
+        GLuint local = v - context->first_vertex[model_idx];
+
+        glm::vec4 world = model->model_matrix * glm::vec4(model->mesh->vertices[local], 1.0);
+        context->world_positions[v] = glm::vec3(world);
+        context->clip_positions[v] = context->view_projection * world;
+        context->world_normals[v] = model->normal_matrix * model->mesh->normals[local];
+    }
+}
+
+/*
+ * triangle setup: near-plane clipping, projection & edge functions
+ */
+
+struct clip_vertex {
+    glm::vec4 clip;
+    glm::vec3 world;
+    glm::vec3 normal;
+    glm::vec2 tex_coord;
+};
+
+static inline struct clip_vertex clip_lerp(const struct clip_vertex &a,
+                                           const struct clip_vertex &b,
+                                           GLfloat t) {
+    struct clip_vertex v;
+    v.clip = a.clip + (b.clip - a.clip) * t;
+    v.world = a.world + (b.world - a.world) * t;
+    v.normal = a.normal + (b.normal - a.normal) * t;
+    v.tex_coord = a.tex_coord + (b.tex_coord - a.tex_coord) * t;
+    return v;
+}
+
+/* project a (clipped) triangle to the screen; GL_FALSE if nothing to draw */
+static GLboolean softrast_setup_triangle(const struct softrast_target *target,
+                                         struct clip_vertex v0,
+                                         struct clip_vertex v1,
+                                         struct clip_vertex v2,
+                                         GLuint model,
+                                         struct softrast_triangle *tri) {
+    const struct clip_vertex *verts[3] = { &v0, &v1, &v2 };
+    GLfloat sx[3], sy[3];
+
+    int i;
+    for (i = 0; i < 3; i++) {
+        GLfloat inv_w = 1.0f / verts[i]->clip.w;
+        glm::vec3 ndc = glm::vec3(verts[i]->clip) * inv_w;
+
+        sx[i] = (ndc.x * 0.5f + 0.5f) * target->width;
+        sy[i] = (0.5f - ndc.y * 0.5f) * target->height;     /* top row first */
+        tri->z[i] = ndc.z * 0.5f + 0.5f;
+        tri->inv_w[i] = inv_w;
+        tri->tex_coord_w[i] = verts[i]->tex_coord * inv_w;
+        tri->normal_w[i] = verts[i]->normal * inv_w;
+        tri->position_w[i] = verts[i]->world * inv_w;
+    }
+
+    if (tri->z[0] > 1.0f && tri->z[1] > 1.0f && tri->z[2] > 1.0f)   /* beyond far plane */
+        return GL_FALSE;
+
+    GLfloat area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+    if (fabsf(area) < 1e-8f)
+        return GL_FALSE;
+
+    /* no face culling in the GL path either: flip edge signs for the other winding */
+    GLfloat sign = (area > 0.0f) ? 1.0f : -1.0f;
+    tri->inv_area = 1.0f / (area * sign);
+
+    for (i = 0; i < 3; i++) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;   /* edge opposite vertex i */
+        tri->edge_a[i] = sign * (sy[j] - sy[k]);
+        tri->edge_b[i] = sign * (sx[k] - sx[j]);
+        tri->edge_c[i] = sign * (sx[j] * sy[k] - sx[k] * sy[j]);
+    }
+
+    tri->min_x = max(0, (GLint)floorf(min(sx[0], min(sx[1], sx[2]))));
+    tri->min_y = max(0, (GLint)floorf(min(sy[0], min(sy[1], sy[2]))));
+    tri->max_x = min((GLint)target->width - 1, (GLint)ceilf(max(sx[0], max(sx[1], sx[2]))));
+    tri->max_y = min((GLint)target->height - 1, (GLint)ceilf(max(sy[0], max(sy[1], sy[2]))));
+    tri->model = model;
+
+    return tri->min_x <= tri->max_x && tri->min_y <= tri->max_y;
+}
+
+static void softrast_setup_triangles(void *data, GLuint begin, GLuint end) {
+    struct softrast_context *context = (struct softrast_context *)data;
+
+    GLuint model_idx = 0;
+    GLuint t;
+    for (t = begin; t < end; t++) {
+        while (model_idx + 1 < context->num_models && t >= context->first_triangle[model_idx + 1])
+            model_idx += 1;
+
+        const struct softrast_model *model = &context->models[model_idx];
+        const struct mesh_data *mesh = model->mesh;
+        GLuint local = t - context->first_triangle[model_idx];
+
+        context->triangle_valid[t*2] = GL_FALSE;
+        context->triangle_valid[t*2+1] = GL_FALSE;
+
+        struct clip_vertex in[3];
+        int i;
+        for (i = 0; i < 3; i++) {
+            GLuint element = mesh->elements[local*3 + i];
+            GLuint v = context->first_vertex[model_idx] + element;
+            in[i].clip = context->clip_positions[v];
+            in[i].world = context->world_positions[v];
+            in[i].normal = context->world_normals[v];
+            in[i].tex_coord = (element < mesh->tex_coords.size()) ? mesh->tex_coords[element] : glm::vec2(0.0);
+        }
+
+        /* clip against the near plane (z = -w), which leaves 0, 3 or 4 vertices */
+        struct clip_vertex out[4];
+        int num_out = 0;
+        for (i = 0; i < 3; i++) {
+            const struct clip_vertex &a = in[i];
+            const struct clip_vertex &b = in[(i + 1) % 3];
+            GLfloat da = a.clip.z + a.clip.w;
+            GLfloat db = b.clip.z + b.clip.w;
+
+            if (da >= 0.0f)
+                out[num_out++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                out[num_out++] = clip_lerp(a, b, da / (da - db));
+        }
+
+        if (num_out < 3)
+            continue;
+
+        context->triangle_valid[t*2] = softrast_setup_triangle(context->target, out[0], out[1], out[2],
+                                                              model_idx, &context->triangles[t*2]);
+        if (num_out == 4)
+            context->triangle_valid[t*2+1] = softrast_setup_triangle(context->target, out[0], out[2], out[3],
+                                                                    model_idx, &context->triangles[t*2+1]);
+    }
+}
+
+/*
+ * shading
+ */
+
+/* bilinear, clamp to edge (as the GL texture parameters) */
+static inline glm::vec4 softrast_sample(const struct softrast_texture *texture,
+                                        glm::vec2 tex_coord) {
+    GLfloat x = tex_coord.x * texture->width - 0.5f;
+    GLfloat y = tex_coord.y * texture->height - 0.5f;
+    x = glm::clamp(x, 0.0f, (GLfloat)texture->width - 1.0f);
+    y = glm::clamp(y, 0.0f, (GLfloat)texture->height - 1.0f);
+
+    GLuint x0 = (GLuint)x, y0 = (GLuint)y;
+    GLuint x1 = min(x0 + 1, texture->width - 1), y1 = min(y0 + 1, texture->height - 1);
+    GLfloat fx = x - x0, fy = y - y0;
+
+    const GLubyte *t00 = &texture->texels[(y0 * texture->width + x0) * 4];
+    const GLubyte *t10 = &texture->texels[(y0 * texture->width + x1) * 4];
+    const GLubyte *t01 = &texture->texels[(y1 * texture->width + x0) * 4];
+    const GLubyte *t11 = &texture->texels[(y1 * texture->width + x1) * 4];
+
+    glm::vec4 result;
+    int c;
+    for (c = 0; c < 4; c++) {
+        GLfloat top = t00[c] + (t10[c] - t00[c]) * fx;
+        GLfloat bottom = t01[c] + (t11[c] - t01[c]) * fx;
+        result[c] = (top + (bottom - top) * fy) / 255.0f;
+    }
+    return result;
+}
+
+/* frag.glsl lighting for one pixel, given barycentrics */
+static inline GLuint softrast_shade(const struct softrast_context *context,
+                                    const struct softrast_triangle *tri,
+                                    GLfloat l0, GLfloat l1, GLfloat l2) {
+    const struct softrast_model *model = &context->models[tri->model];
+
+    /* perspective-correct interpolation */
+    GLfloat w = 1.0f / (l0 * tri->inv_w[0] + l1 * tri->inv_w[1] + l2 * tri->inv_w[2]);
+    glm::vec3 normal = glm::normalize((tri->normal_w[0] * l0 + tri->normal_w[1] * l1 + tri->normal_w[2] * l2) * w);
+
+    glm::vec3 total_lighting = model->ambient;
+    GLuint i;
+    for (i = 0; i < context->num_lights; i++) {
+        const struct LightSource *light = &context->lights[i];
+        glm::vec3 light_direction;
+        GLfloat attenuation;
+
+        if (light->position.w == 0.0) {
+            attenuation = 1.0;
+            light_direction = glm::normalize(glm::vec3(light->position));
+        }
+        else {
+            glm::vec3 position = (tri->position_w[0] * l0 + tri->position_w[1] * l1 + tri->position_w[2] * l2) * w;
+            glm::vec3 to_light = glm::vec3(light->position) - position;
+            GLfloat dist = glm::length(to_light);
+            attenuation = 1.0f / (light->attenuation.x * dist * dist + light->attenuation.y * dist + light->attenuation.z);
+            light_direction = to_light / dist;
+        }
+
+        glm::vec3 diffuse = attenuation
+                          * light->diffuse
+                          * softrast_material_diffuse
+                          * max(0.0f, glm::dot(normal, light_direction));
+        total_lighting = glm::clamp(total_lighting + diffuse, 0.0f, 1.0f);
+    }
+
+    glm::vec4 colour = glm::vec4(total_lighting, 1.0);
+    if (model->texture) {
+        glm::vec2 tex_coord = (tri->tex_coord_w[0] * l0 + tri->tex_coord_w[1] * l1 + tri->tex_coord_w[2] * l2) * w;
+        colour = softrast_sample(model->texture, tex_coord) * colour;
+    }
+
+    return pack_colour(colour);
+}
+
+/*
+ * rasterization, one tile per task
+ */
+
+/* rasterize one triangle within a tile rectangle */
+static void softrast_raster_triangle(const struct softrast_context *context,
+                                     const struct softrast_triangle *tri,
+                                     GLint x0, GLint y0, GLint x1, GLint y1) {
+    struct softrast_target *target = context->target;
+
+    GLint min_x = max(x0, tri->min_x) & ~3;      /* 4-pixel aligned (tiles are too) */
+    GLint min_y = max(y0, tri->min_y);
+    GLint max_x = min(x1, tri->max_x);
+    GLint max_y = min(y1, tri->max_y);
+    if (min_x > max_x || min_y > max_y)
+        return;
+
+    GLint span_min_x = max(x0, tri->min_x);    /* first pixel actually ours */
+
+#ifdef __SSE2__
+    const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 span_min = _mm_set1_ps((GLfloat)span_min_x);
+    const __m128 span_max = _mm_set1_ps((GLfloat)max_x + 1.0f);
+    const __m128 inv_area = _mm_set1_ps(tri->inv_area);
+    __m128 a[3], step[3];
+    int e;
+    for (e = 0; e < 3; e++) {
+        a[e] = _mm_set1_ps(tri->edge_a[e]);
+        step[e] = _mm_set1_ps(tri->edge_a[e] * 4.0f);
+    }
+    const __m128 z0 = _mm_set1_ps(tri->z[0]);
+    const __m128 z1 = _mm_set1_ps(tri->z[1]);
+    const __m128 z2 = _mm_set1_ps(tri->z[2]);
+#endif
+
+    GLint y;
+    for (y = min_y; y <= max_y; y++) {
+        GLfloat py = y + 0.5f;
+        GLfloat *depth_row = &target->depth[(size_t)y * target->stride];
+        GLuint *colour_row = &target->colour[(size_t)y * target->stride];
+
+#ifdef __SSE2__
+        __m128 px = _mm_add_ps(_mm_set1_ps(min_x + 0.5f), lane);
+        __m128 w[3];
+        for (e = 0; e < 3; e++)
+            w[e] = _mm_add_ps(_mm_mul_ps(a[e], px),
+                              _mm_set1_ps(tri->edge_b[e] * py + tri->edge_c[e]));
+#endif
+
+        GLint x;
+        for (x = min_x; x <= max_x; x += 4) {
+            GLfloat l[3][4];
+            GLfloat z[4];
+            int mask;
+
+#ifdef __SSE2__
+            /* px is at pixel centres: lanes outside [span_min_x, max_x] are masked off */
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w[0], zero),
+                                                  _mm_cmpge_ps(w[1], zero)),
+                                       _mm_cmpge_ps(w[2], zero));
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(px, span_min),
+                                                   _mm_cmplt_ps(px, span_max)));
+            __m128 l0 = _mm_mul_ps(w[0], inv_area);
+            __m128 l1 = _mm_mul_ps(w[1], inv_area);
+            __m128 l2 = _mm_mul_ps(w[2], inv_area);
+            __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, z0), _mm_mul_ps(l1, z1)), _mm_mul_ps(l2, z2));
+            __m128 old_depth = _mm_loadu_ps(&depth_row[x]);
+
+            inside = _mm_and_ps(inside, _mm_cmplt_ps(depth, old_depth));   /* GL_LESS */
+            inside = _mm_and_ps(inside, _mm_cmple_ps(depth, one));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(depth, zero));
+            mask = _mm_movemask_ps(inside);
+
+            if (mask) {
+                _mm_storeu_ps(&depth_row[x], _mm_or_ps(_mm_and_ps(inside, depth),
+                                                       _mm_andnot_ps(inside, old_depth)));
+                _mm_storeu_ps(l[0], l0);
+                _mm_storeu_ps(l[1], l1);
+                _mm_storeu_ps(l[2], l2);
+                _mm_storeu_ps(z, depth);
+            }
+
+            for (e = 0; e < 3; e++)
+                w[e] = _mm_add_ps(w[e], step[e]);
+            px = _mm_add_ps(px, four);
+#else
+            mask = 0;
+            int k;
+            for (k = 0; k < 4; k++) {
+                GLfloat px = x + k + 0.5f;
+                GLfloat e0 = tri->edge_a[0] * px + tri->edge_b[0] * py + tri->edge_c[0];
+                GLfloat e1 = tri->edge_a[1] * px + tri->edge_b[1] * py + tri->edge_c[1];
+                GLfloat e2 = tri->edge_a[2] * px + tri->edge_b[2] * py + tri->edge_c[2];
+                l[0][k] = e0 * tri->inv_area;
+                l[1][k] = e1 * tri->inv_area;
+                l[2][k] = e2 * tri->inv_area;
+                z[k] = l[0][k] * tri->z[0] + l[1][k] * tri->z[1] + l[2][k] * tri->z[2];
+
+                if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f
+                    && x + k >= span_min_x && x + k <= max_x
+                    && z[k] < depth_row[x + k] && z[k] >= 0.0f && z[k] <= 1.0f) {
+                    depth_row[x + k] = z[k];
+                    mask |= 1 << k;
+                }
+            }
+#endif
+
+            if (!mask)
+                continue;
+
+            int k;
+            for (k = 0; k < 4; k++) {
+                if (mask & (1 << k))
+                    colour_row[x + k] = softrast_shade(context, tri, l[0][k], l[1][k], l[2][k]);
+            }
+        }
+    }
+}
+
+static void softrast_raster_tiles(void *data, GLuint begin, GLuint end) {
+    struct softrast_context *context = (struct softrast_context *)data;
+
+    GLuint tile;
+    for (tile = begin; tile < end; tile++) {
+        GLint x0 = (tile % context->tiles_x) * SOFTRAST_TILE_SIZE;
+        GLint y0 = (tile / context->tiles_x) * SOFTRAST_TILE_SIZE;
+        GLint x1 = min(x0 + SOFTRAST_TILE_SIZE, (GLint)context->target->width) - 1;
+        GLint y1 = min(y0 + SOFTRAST_TILE_SIZE, (GLint)context->target->height) - 1;
+
+        const vector<GLuint> &bin = context->bins[tile];
+        GLuint i;
+        for (i = 0; i < bin.size(); i++)
+            softrast_raster_triangle(context, &context->triangles[bin[i]], x0, y0, x1, y1);
+    }
+}
+
+/* draw models into context->target (which the caller has cleared) */
+void softrast_draw(struct softrast_context *context,
+                   const struct softrast_model *models,
+                   GLuint num_models,
+                   glm::mat4 view,
+                   glm::mat4 projection,
+                   const struct LightSource *lights,
+                   GLuint num_lights) {
+    struct softrast_target *target = context->target;
+
+    context->models = models;
+    context->num_models = num_models;
+    context->lights = lights;
+    context->num_lights = num_lights;
+    context->view_projection = projection * view;
+
+    context->first_vertex.clear();
+    context->first_triangle.clear();
+    GLuint num_vertices = 0, num_triangles = 0;
+    GLuint i;
+    for (i = 0; i < num_models; i++) {
+        context->first_vertex.push_back(num_vertices);
+        context->first_triangle.push_back(num_triangles);
+        num_vertices += (GLuint)models[i].mesh->vertices.size();
+        num_triangles += (GLuint)models[i].mesh->elements.size() / 3;
+    }
+
+    context->clip_positions.resize(num_vertices);
+    context->world_positions.resize(num_vertices);
+    context->world_normals.resize(num_vertices);
+    context->triangles.resize(num_triangles * 2);
+    context->triangle_valid.resize(num_triangles * 2);
+
+    thread_pool_run(context->pool, num_vertices, 1024, softrast_transform_vertices, context);
+    thread_pool_run(context->pool, num_triangles, 256, softrast_setup_triangles, context);
+
+    /* bin in draw order, so each tile sees triangles in the same order GL would */
+    context->tiles_x = (target->width + SOFTRAST_TILE_SIZE - 1) / SOFTRAST_TILE_SIZE;
+    context->tiles_y = (target->height + SOFTRAST_TILE_SIZE - 1) / SOFTRAST_TILE_SIZE;
+    context->bins.resize(context->tiles_x * context->tiles_y);
+    for (i = 0; i < context->bins.size(); i++)
+        context->bins[i].clear();
+
+    for (i = 0; i < num_triangles * 2; i++) {
+        if (!context->triangle_valid[i])
+            continue;
+
+        const struct softrast_triangle *tri = &context->triangles[i];
+        GLint tx, ty;
+        for (ty = tri->min_y / SOFTRAST_TILE_SIZE; ty <= tri->max_y / SOFTRAST_TILE_SIZE; ty++)
+            for (tx = tri->min_x / SOFTRAST_TILE_SIZE; tx <= tri->max_x / SOFTRAST_TILE_SIZE; tx++)
+                context->bins[ty * context->tiles_x + tx].push_back(i);
+    }
+
+    thread_pool_run(context->pool, (GLuint)context->bins.size(), 1, softrast_raster_tiles, context);
+}
+
+/*
+ * image files
+ */
+
+/* uncompressed or RLE truecolour/greyscale TGA, as glfwLoadTexture2D reads */
+GLboolean softrast_load_tga(const char *path,
+                            struct softrast_texture *texture) {
+    GLint length;
+    GLubyte *data = (GLubyte *)file_contents(path, &length);
+    if (!data)
+        return GL_FALSE;
+
+    GLubyte *end = data + length;
+    if (length < 18) {
+        free(data);
+        return GL_FALSE;
+    }
+
+    GLuint id_length = data[0];
+    GLuint colour_map_type = data[1];
+    GLuint image_type = data[2];
+    GLuint colour_map_length = data[5] | data[6] << 8;
+    GLuint colour_map_bits = data[7];
+    GLuint width = data[12] | data[13] << 8;
+    GLuint height = data[14] | data[15] << 8;
+    GLuint bytes_per_pixel = data[16] / 8;
+    GLboolean top_first = (data[17] & 0x20) != 0;
+
+    GLboolean rle = image_type == 10 || image_type == 11;
+    GLuint base_type = rle ? image_type - 8 : image_type;
+    if ((base_type != 2 && base_type != 3) || colour_map_type != 0
+        || bytes_per_pixel < 1 || bytes_per_pixel > 4) {
+        fprintf(stderr, "Unsupported TGA format in %s\n", path);
+        free(data);
+        return GL_FALSE;
+    }
+
+    GLubyte *ptr = data + 18 + id_length + colour_map_length * ((colour_map_bits + 7) / 8);
+
+    texture->width = width;
+    texture->height = height;
+    texture->texels.assign((size_t)width * height * 4, 255);
+
+    GLuint pixel = 0, total = width * height;
+    while (pixel < total && ptr < end) {
+        GLuint run = 1;
+        GLboolean repeat = GL_FALSE;
+        if (rle) {
+            repeat = (*ptr & 0x80) != 0;
+            run = (*ptr & 0x7f) + 1;
+            ptr++;
+        }
+
+        GLuint i;
+        for (i = 0; i < run && pixel < total; i++, pixel++) {
+            if (ptr + bytes_per_pixel > end)
+                break;
+
+            /* file pixels are BGR(A); rows stored bottom first unless top_first */
+            GLuint row = pixel / width, column = pixel % width;
+            if (top_first)
+                row = height - 1 - row;
+            GLubyte *texel = &texture->texels[((size_t)row * width + column) * 4];
+
+            if (bytes_per_pixel <= 2) {
+                texel[0] = texel[1] = texel[2] = ptr[0];
+            }
+            else {
+                texel[0] = ptr[2];
+                texel[1] = ptr[1];
+                texel[2] = ptr[0];
+                if (bytes_per_pixel == 4)
+                    texel[3] = ptr[3];
+            }
+
+            if (!repeat || i == run - 1)
+                ptr += bytes_per_pixel;
+        }
+    }
+
+    free(data);
+    return GL_TRUE;
+}
+
+/* binary PPM (RGB, top row first) */
+GLboolean softrast_write_ppm(const struct softrast_target *target,
+                             const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for writing\n", path);
+        return GL_FALSE;
+    }
+
+    fprintf(f, "P6\n%u %u\n255\n", target->width, target->height);
+
+    vector<GLubyte> row(target->width * 3);
+    GLuint x, y;
+    for (y = 0; y < target->height; y++) {
+        for (x = 0; x < target->width; x++) {
+            GLuint colour = target->colour[(size_t)y * target->stride + x];
+            row[x*3] = colour & 0xff;
+            row[x*3+1] = (colour >> 8) & 0xff;
+            row[x*3+2] = (colour >> 16) & 0xff;
+        }
+        fwrite(&row[0], 1, row.size(), f);
+    }
+
+    fclose(f);
+    return GL_TRUE;
+}
+
+/* read the pixels of a binary PPM */
+static GLboolean read_ppm(const char *path,
+                          GLuint *width,
+                          GLuint *height,
+                          vector<GLubyte> &pixels) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for reading\n", path);
+        return GL_FALSE;
+    }
+
+    GLuint max_value;
+    GLboolean ok = fscanf(f, "P6 %u %u %u", width, height, &max_value) == 3 && max_value == 255;
+    if (ok) {
+        fgetc(f);   /* single whitespace before the data */
+        pixels.resize((size_t)*width * *height * 3);
+        ok = fread(&pixels[0], 1, pixels.size(), f) == pixels.size();
+    }
+
+    fclose(f);
+    return ok;
+}
+
+/* per-channel error between two same-sized images (e.g. a software frame
+ * and a captured GL frame); GL_FALSE if they can't be compared */
+GLboolean softrast_compare_ppm(const char *path_a,
+                               const char *path_b,
+                               GLfloat *rms_error,
+                               GLuint *max_error) {
+    GLuint width_a, height_a, width_b, height_b;
+    vector<GLubyte> a, b;
+
+    if (!read_ppm(path_a, &width_a, &height_a, a) || !read_ppm(path_b, &width_b, &height_b, b))
+        return GL_FALSE;
+    if (width_a != width_b || height_a != height_b) {
+        fprintf(stderr, "Image sizes differ: %ux%u vs %ux%u\n", width_a, height_a, width_b, height_b);
+        return GL_FALSE;
+    }
+
+    double sum = 0.0;
+    *max_error = 0;
+    size_t i;
+    for (i = 0; i < a.size(); i++) {
+        GLuint diff = (GLuint)abs((int)a[i] - (int)b[i]);
+        sum += (double)diff * diff;
+        *max_error = max(*max_error, diff);
+    }
+    *rms_error = (GLfloat)sqrt(sum / a.size());
+
+    return GL_TRUE;
+}
@@ -0,0 +1,90 @@
+#define SOFTRAST_TILE_SIZE 32   /* pixels; a multiple of 4 (SIMD width) */
+
+/* structure definitions */
+
+/* RGBA8 image; rows bottom to top, as glfwLoadTexture2D hands them to GL */
+struct softrast_texture {
+    GLuint width;
+    GLuint height;
+    std::vector<GLubyte> texels;
+};
+
+/* colour (RGBA8, top row first) + depth buffer; rows are padded to a
+ * multiple of 4 pixels so SIMD loads never run off the end of a row */
+struct softrast_target {
+    GLuint width;
+    GLuint height;
+    GLuint stride;
+    std::vector<GLuint> colour;
+    std::vector<GLfloat> depth;
+};
+
+/* one model to draw: the same mesh data make_model uploads to GL */
+struct softrast_model {
+    const struct mesh_data *mesh;
+    const struct softrast_texture *texture;     /* NULL: lighting only */
+    glm::mat4 model_matrix;
+    glm::mat3 normal_matrix;
+    glm::vec3 ambient;
+};
+
+/* triangle after clipping & setup, ready to rasterize */
+struct softrast_triangle {
+    GLfloat edge_a[3], edge_b[3], edge_c[3];   /* edge functions: a*x + b*y + c >= 0 inside */
+    GLfloat inv_area;
+    GLfloat z[3];                              /* NDC depth mapped to [0,1] */
+    GLfloat inv_w[3];
+    glm::vec2 tex_coord_w[3];                  /* attributes pre-divided by w */
+    glm::vec3 normal_w[3];
+    glm::vec3 position_w[3];                   /* world space, for point lights */
+    GLint min_x, min_y, max_x, max_y;          /* pixel bounds, clamped to the target */
+    GLuint model;
+};
+
+/* per-frame working state, reused between frames to avoid reallocation */
+struct softrast_context {
+    struct thread_pool *pool;
+    struct softrast_target *target;
+
+    const struct softrast_model *models;
+    GLuint num_models;
+    const struct LightSource *lights;
+    GLuint num_lights;
+    glm::mat4 view_projection;
+
+    std::vector<glm::vec4> clip_positions;     /* per vertex, all models back to back */
+    std::vector<glm::vec3> world_positions;
+    std::vector<glm::vec3> world_normals;
+    std::vector<GLuint> first_vertex;          /* per model */
+    std::vector<GLuint> first_triangle;        /* per model */
+
+    std::vector<struct softrast_triangle> triangles;   /* 2 slots per input triangle */
+    std::vector<GLubyte> triangle_valid;
+
+    GLuint tiles_x, tiles_y;
+    std::vector<std::vector<GLuint> > bins;    /* per tile: triangles in draw order */
+};
+
+/* function prototypes */
+void softrast_target_resize(struct softrast_target *target,
+                            GLuint width,
+                            GLuint height);
+void softrast_clear(struct softrast_target *target,
+                    glm::vec4 colour);
+
+void softrast_draw(struct softrast_context *context,
+                   const struct softrast_model *models,
+                   GLuint num_models,
+                   glm::mat4 view,
+                   glm::mat4 projection,
+                   const struct LightSource *lights,
+                   GLuint num_lights);
+
+GLboolean softrast_load_tga(const char *path,
+                            struct softrast_texture *texture);
+GLboolean softrast_write_ppm(const struct softrast_target *target,
+                             const char *path);
+GLboolean softrast_compare_ppm(const char *path_a,
+                               const char *path_b,
+                               GLfloat *rms_error,
+                               GLuint *max_error);
@@ -0,0 +1,285 @@
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GL/glfw.h>
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "util.h"
+#include "texture_array.h"
+
+using namespace std;
+
+/*
+ * Texture arrays: instead of one GL_TEXTURE_2D per model, textures of the
+ * same size & format become layers of one GL_TEXTURE_2D_ARRAY. Models
+ * whose textures share an array can be drawn in one pass (and one
+ * multi-draw), each picking its layer in the shader.
+ */
+
+/* read a texture file as tightly packed RGB or RGBA rows, bottom row first
+ * (as glfwLoadTexture2D would upload it); greyscale is expanded to RGB */
+static GLboolean texture_read(const char *path,
+                              vector<GLubyte> *pixels,
+                              GLuint *width,
+                              GLuint *height,
+                              GLenum *format) {
+    GLFWimage image;
+    if (!glfwReadImage(path, &image, GLFW_NO_RESCALE_BIT)) {
+        fprintf(stderr, "Unable to load texture %s\n", path);
+        return GL_FALSE;
+    }
+
+    size_t texels = (size_t)image.Width * image.Height;
+    GLboolean ok = GL_TRUE;
+    switch (image.BytesPerPixel) {
+        case 1: {
+            pixels->resize(texels * 3);
+            size_t i;
+            for (i = 0; i < texels; i++)
+                memset(&(*pixels)[i * 3], image.Data[i], 3);
+            *format = GL_RGB;
+            break;
+        }
+        case 3:
+            pixels->assign(image.Data, image.Data + texels * 3);
+            *format = GL_RGB;
+            break;
+        case 4:
+            pixels->assign(image.Data, image.Data + texels * 4);
+            *format = GL_RGBA;
+            break;
+        default:
+            fprintf(stderr, "Unsupported pixel format in %s\n", path);
+            ok = GL_FALSE;
+            break;
+    }
+
+    *width = (GLuint)image.Width;
+    *height = (GLuint)image.Height;
+    glfwFreeImage(&image);
+    return ok;
+}
+
+/* hash of a file's contents; GL_FALSE if it can't be read */
+static GLboolean texture_hash(const char *path, GLuint64 *hash) {
+    GLint length;
+    void *contents = file_contents(path, &length);
+    if (!contents)
+        return GL_FALSE;
+
+    *hash = hash_bytes(contents, length, HASH_SEED);
+    free(contents);
+    return GL_TRUE;
+}
+
+/* a new, empty array (storage is allocated by texture_arrays_build) */
+static GLuint texture_array_create(struct texture_arrays *arrays,
+                                   GLuint width,
+                                   GLuint height,
+                                   GLenum format) {
+    struct texture_array array = texture_array();
+    glGenTextures(1, &array.texture);
+    array.width = width;
+    array.height = height;
+    array.format = format;
+
+    arrays->arrays.push_back(array);
+    return (GLuint)arrays->arrays.size() - 1;
+}
+
+/* give a layer its texels (loaded, re-read from its file or solid white)
+ * and drop the CPU copy; the array must be bound to GL_TEXTURE_2D_ARRAY */
+static void texture_array_upload(struct texture_array *array,
+                                 GLuint layer) {
+    struct texture_layer *source = &array->layers[layer];
+    GLuint channels = (array->format == GL_RGBA) ? 4 : 3;
+
+    if (source->pixels.empty() && !source->path.empty()) {
+        GLuint width, height;
+        GLenum format;
+        if (!texture_read(source->path.c_str(), &source->pixels, &width, &height, &format)
+            || width != array->width || height != array->height || format != array->format) {
+            fprintf(stderr, "%s no longer matches its texture array; leaving its layer white\n",
+                    source->path.c_str());
+            source->pixels.clear();
+        }
+    }
+    if (source->pixels.empty())
+        source->pixels.assign((size_t)array->width * array->height * channels, 255);
+
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+                    array->width, array->height, 1,
+                    array->format, GL_UNSIGNED_BYTE, &source->pixels[0]);
+
+    vector<GLubyte>().swap(source->pixels);
+}
+
+/* layer for a texture file, or for solid white if texture_path is NULL
+ * (which shares the first array, so add textured models first). Needs
+ * texture_arrays_build before it is drawn with */
+GLboolean texture_arrays_add(struct texture_arrays *arrays,
+                             const char *texture_path,
+                             GLuint *texture,
+                             GLint *layer) {
+    GLuint a, l;
+
+    /* solid white: one layer, shared by every untextured model */
+    if (!texture_path) {
+        if (arrays->arrays.empty())
+            texture_array_create(arrays, TEXTURE_ARRAY_SOLID_SIZE, TEXTURE_ARRAY_SOLID_SIZE, GL_RGBA);
+
+        struct texture_array *array = &arrays->arrays[0];
+        for (l = 0; l < array->layers.size(); l++) {
+            if (array->layers[l].path.empty())
+                break;
+        }
+        if (l == array->layers.size()) {
+            array->layers.push_back(texture_layer());
+            array->dirty = GL_TRUE;
+        }
+
+        *texture = array->texture;
+        *layer = (GLint)l;
+        return GL_TRUE;
+    }
+
+    /* already a layer */
+    for (a = 0; a < arrays->arrays.size(); a++) {
+        for (l = 0; l < arrays->arrays[a].layers.size(); l++) {
+            if (arrays->arrays[a].layers[l].path == texture_path) {
+                *texture = arrays->arrays[a].texture;
+                *layer = (GLint)l;
+                return GL_TRUE;
+            }
+        }
+    }
+
+    struct texture_layer fresh = texture_layer();
+    fresh.path = texture_path;
+    GLuint width, height;
+    GLenum format;
+    if (!texture_hash(texture_path, &fresh.hash)
+        || !texture_read(texture_path, &fresh.pixels, &width, &height, &format))
+        return GL_FALSE;
+
+    for (a = 0; a < arrays->arrays.size(); a++) {
+        const struct texture_array *array = &arrays->arrays[a];
+        if (array->width == width && array->height == height && array->format == format)
+            break;
+    }
+    if (a == arrays->arrays.size())
+        a = texture_array_create(arrays, width, height, format);
+
+    struct texture_array *array = &arrays->arrays[a];
+    array->layers.push_back(fresh);
+    array->dirty = GL_TRUE;
+
+    *texture = array->texture;
+    *layer = (GLint)array->layers.size() - 1;
+    return GL_TRUE;
+}
+
+/* (re)allocate every array that gained layers, upload them & make mipmaps */
+void texture_arrays_build(struct texture_arrays *arrays) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    GLuint a, l;
+    for (a = 0; a < arrays->arrays.size(); a++) {
+        struct texture_array *array = &arrays->arrays[a];
+        if (!array->dirty)
+            continue;
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0,
+                     (array->format == GL_RGBA) ? GL_RGBA8 : GL_RGB8,
+                     array->width, array->height, (GLsizei)array->layers.size(), 0,
+                     array->format, GL_UNSIGNED_BYTE, NULL);
+        for (l = 0; l < array->layers.size(); l++)
+            texture_array_upload(array, l);
+
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        /* RGBA8 per texel (see texture_create), plus a third for the mip chain */
+        array->bytes = (GLulong)array->width * array->height * 4 * array->layers.size() * 4 / 3;
+        array->dirty = GL_FALSE;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+/* re-upload every layer loaded from `path` whose contents changed; a file
+ * that changed size or format keeps its previous version (it would need
+ * another array). Returns the number of layers replaced */
+GLuint texture_arrays_reload_path(struct texture_arrays *arrays,
+                                  const char *path) {
+    GLuint reloaded = 0;
+    GLuint a, l;
+
+    for (a = 0; a < arrays->arrays.size(); a++) {
+        struct texture_array *array = &arrays->arrays[a];
+        for (l = 0; l < array->layers.size(); l++) {
+            struct texture_layer *layer = &array->layers[l];
+            GLuint64 hash;
+            if (layer->path != path || !texture_hash(path, &hash) || hash == layer->hash)
+                continue;
+
+            vector<GLubyte> pixels;
+            GLuint width, height;
+            GLenum format;
+            if (!texture_read(path, &pixels, &width, &height, &format))
+                continue;
+            if (width != array->width || height != array->height || format != array->format) {
+                fprintf(stderr, "%s changed size or format; keeping the previous version\n", path);
+                continue;
+            }
+
+            layer->hash = hash;
+            layer->pixels.swap(pixels);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture);
+            texture_array_upload(array, l);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            reloaded += 1;
+        }
+    }
+
+    return reloaded;
+}
+
+void texture_arrays_report(const struct texture_arrays *arrays,
+                           FILE *out) {
+    GLulong bytes = 0;
+    GLuint layers = 0;
+    GLuint a;
+
+    for (a = 0; a < arrays->arrays.size(); a++) {
+        const struct texture_array *array = &arrays->arrays[a];
+        fprintf(out, "texture array %u: %ux%u %s, %u layers (%lu bytes)\n",
+                a, array->width, array->height,
+                (array->format == GL_RGBA) ? "RGBA" : "RGB",
+                (GLuint)array->layers.size(), array->bytes);
+        bytes += array->bytes;
+        layers += (GLuint)array->layers.size();
+    }
+    fprintf(out, "texture arrays: %u arrays, %u layers, %lu bytes\n",
+            (GLuint)arrays->arrays.size(), layers, bytes);
+}
+
+/* delete every array (call before the GL context goes away) */
+void texture_arrays_destroy(struct texture_arrays *arrays) {
+    GLuint a;
+    for (a = 0; a < arrays->arrays.size(); a++)
+        glDeleteTextures(1, &arrays->arrays[a].texture);
+    arrays->arrays.clear();
+}
@@ -0,0 +1,41 @@
+#define TEXTURE_ARRAY_SOLID_SIZE 4      /* side of the array made for solid layers if no texture came first */
+
+/* structure definitions */
+
+/* one layer: a texture file, or solid white for untextured models */
+struct texture_layer {
+    std::string path;               /* empty for solid white */
+    GLuint64 hash;                  /* of the file, to notice when it changes */
+    std::vector<GLubyte> pixels;    /* loaded, waiting for texture_arrays_build */
+};
+
+/* every texture of one size & format, as the layers of one
+ * GL_TEXTURE_2D_ARRAY with mipmaps */
+struct texture_array {
+    GLuint texture;
+    GLuint width, height;
+    GLenum format;                  /* GL_RGB or GL_RGBA */
+    std::vector<struct texture_layer> layers;
+    GLboolean dirty;                /* layers added since storage was allocated */
+    GLulong bytes;
+};
+
+/* models' textures packed into as few texture arrays as their sizes &
+ * formats allow, so models that differ only in texture share a bind (and a
+ * pass): each model picks its layer per draw, by in_DrawID */
+struct texture_arrays {
+    std::vector<struct texture_array> arrays;
+};
+
+/* function prototypes */
+GLboolean texture_arrays_add(struct texture_arrays *arrays,
+                             const char *texture_path,
+                             GLuint *texture,
+                             GLint *layer);
+void texture_arrays_build(struct texture_arrays *arrays);
+GLuint texture_arrays_reload_path(struct texture_arrays *arrays,
+                                  const char *path);
+
+void texture_arrays_report(const struct texture_arrays *arrays,
+                           FILE *out);
+void texture_arrays_destroy(struct texture_arrays *arrays);
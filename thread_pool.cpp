@@ -0,0 +1,121 @@
+#include <GL/glew.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+
+using namespace std;
+
+/*
+ * Minimal fork/join pool for data-parallel CPU work (baking, software
+ * rasterization). Items are claimed `grain` at a time from a shared counter,
+ * so uneven items (e.g. tiles with more triangles) balance themselves.
+ */
+
+/* claim & process chunks of the current job until none are left */
+static void thread_pool_drain(struct thread_pool *pool) {
+    for (;;) {
+        GLuint begin = pool->next.fetch_add(pool->grain);
+        if (begin >= pool->count)
+            return;
+
+        GLuint end = begin + pool->grain;
+        if (end > pool->count)
+            end = pool->count;
+
+        pool->task(pool->context, begin, end);
+    }
+}
+
+static void thread_pool_worker(struct thread_pool *pool) {
+    GLuint seen_generation = 0;
+
+    for (;;) {
+        {
+            unique_lock<mutex> guard(pool->lock);
+            while (!pool->stopping && pool->generation == seen_generation)
+                pool->wake.wait(guard);
+
+            if (pool->stopping)
+                return;
+            seen_generation = pool->generation;
+        }
+
+        thread_pool_drain(pool);
+
+        unique_lock<mutex> guard(pool->lock);
+        pool->busy -= 1;
+        if (pool->busy == 0)
+            pool->finished.notify_all();
+    }
+}
+
+/* num_threads = 0 uses one worker per hardware thread (minus the caller) */
+void thread_pool_start(struct thread_pool *pool, GLuint num_threads) {
+    if (num_threads == 0) {
+        num_threads = thread::hardware_concurrency();
+        num_threads = (num_threads > 1) ? num_threads - 1 : 0;
+    }
+
+    pool->task = NULL;
+    pool->context = NULL;
+    pool->count = 0;
+    pool->grain = 1;
+    pool->next = 0;
+    pool->busy = 0;
+    pool->generation = 0;
+    pool->stopping = GL_FALSE;
+
+    GLuint i;
+    for (i = 0; i < num_threads; i++)
+        pool->workers.push_back(thread(thread_pool_worker, pool));
+}
+
+void thread_pool_run(struct thread_pool *pool,
+                     GLuint count,
+                     GLuint grain,
+                     thread_pool_task task,
+                     void *context) {
+    if (count == 0)
+        return;
+
+    if (pool->workers.empty()) {
+        task(context, 0, count);
+        return;
+    }
+
+    {
+        unique_lock<mutex> guard(pool->lock);
+        pool->task = task;
+        pool->context = context;
+        pool->count = count;
+        pool->grain = grain > 0 ? grain : 1;
+        pool->next = 0;
+        pool->busy = (GLuint)pool->workers.size();
+        pool->generation += 1;
+    }
+    pool->wake.notify_all();
+
+    thread_pool_drain(pool);
+
+    unique_lock<mutex> guard(pool->lock);
+    while (pool->busy > 0)
+        pool->finished.wait(guard);
+}
+
+void thread_pool_stop(struct thread_pool *pool) {
+    {
+        unique_lock<mutex> guard(pool->lock);
+        pool->stopping = GL_TRUE;
+    }
+    pool->wake.notify_all();
+
+    GLuint i;
+    for (i = 0; i < pool->workers.size(); i++)
+        pool->workers[i].join();
+    pool->workers.clear();
+}
@@ -0,0 +1,33 @@
+/* called with a half-open range [begin, end) of work items */
+typedef void (*thread_pool_task)(void *context, GLuint begin, GLuint end);
+
+/* structure definitions */
+
+/* fixed set of worker threads that split ranges of independent work items.
+ * thread_pool_run blocks until the whole range is done; the calling thread
+ * works through the range too */
+struct thread_pool {
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    /* current job */
+    thread_pool_task task;
+    void *context;
+    GLuint count;
+    GLuint grain;
+    std::atomic<GLuint> next;       /* first unclaimed item */
+    GLuint busy;                    /* workers still inside the job */
+    GLuint generation;              /* bumped for every new job */
+    GLboolean stopping;
+};
+
+/* function prototypes */
+void thread_pool_start(struct thread_pool *pool, GLuint num_threads);
+void thread_pool_run(struct thread_pool *pool,
+                     GLuint count,
+                     GLuint grain,
+                     thread_pool_task task,
+                     void *context);
+void thread_pool_stop(struct thread_pool *pool);
@@ -0,0 +1,620 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <GL/glfw.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util.h"
+#include "heightmap.h"
+#include "tile_stream.h"
+
+using namespace std;
+
+/*
+ * Out-of-core terrain. The tile file is mapped rather than read, so the
+ * OS pages it in (and out again) as tiles are touched; the loader thread
+ * does the touching, copying each requested tile out of the mapping, so
+ * page faults & disk waits never land on the render thread. The render
+ * thread only moves loaded tiles into atlas slots and uploads them; height
+ * queries use a CPU copy of each resident tile's heights, never the mapping.
+ */
+
+static GLuint tile_data_bytes() {
+    return TILE_SAMPLES * TILE_SAMPLES * (sizeof(GLushort) + 2 * sizeof(GLubyte));
+}
+
+/* split a heightmap into a tile file */
+GLboolean tile_file_write(const struct heightmap *map,
+                          const char *path) {
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Unable to open %s for writing\n", path);
+        return GL_FALSE;
+    }
+
+    struct tile_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TILE_FILE_MAGIC, sizeof(header.magic));
+    header.tiles_x = (map->width - 2) / TILE_QUADS + 1;
+    header.tiles_z = (map->depth - 2) / TILE_QUADS + 1;
+    header.width = map->width;
+    header.depth = map->depth;
+    header.tile_bytes = (tile_data_bytes() + TILE_FILE_PAGE - 1) / TILE_FILE_PAGE * TILE_FILE_PAGE;
+    header.origin[0] = map->origin.x;
+    header.origin[1] = map->origin.y;
+    header.spacing[0] = map->spacing.x;
+    header.spacing[1] = map->spacing.y;
+    header.height_min = map->height_min;
+    header.height_scale = map->height_scale;
+    memcpy(header.tex_transform, glm::value_ptr(map->tex_transform), sizeof(header.tex_transform));
+
+    vector<GLubyte> page(TILE_FILE_PAGE, 0);
+    memcpy(&page[0], &header, sizeof(header));
+    GLboolean written = fwrite(&page[0], 1, page.size(), out) == page.size();
+
+    /* samples past the terrain's far edges repeat the edge */
+    vector<GLubyte> tile(header.tile_bytes, 0);
+    GLushort *heights = (GLushort*)&tile[0];
+    GLubyte *normals = &tile[TILE_SAMPLES * TILE_SAMPLES * sizeof(GLushort)];
+    GLuint tx, tz, i, j;
+    for (tz = 0; tz < header.tiles_z && written; tz++) {
+        for (tx = 0; tx < header.tiles_x && written; tx++) {
+            for (j = 0; j < TILE_SAMPLES; j++) {
+                for (i = 0; i < TILE_SAMPLES; i++) {
+                    size_t source = (size_t)min(tz * TILE_QUADS + j, map->depth - 1) * map->width
+                                    + min(tx * TILE_QUADS + i, map->width - 1);
+                    heights[j * TILE_SAMPLES + i] = map->heights[source];
+                    normals[(j * TILE_SAMPLES + i) * 2] = map->normals[source * 2];
+                    normals[(j * TILE_SAMPLES + i) * 2 + 1] = map->normals[source * 2 + 1];
+                }
+            }
+            written = fwrite(&tile[0], 1, tile.size(), out) == tile.size();
+        }
+    }
+
+    if (fclose(out) != 0 || !written) {
+        fprintf(stderr, "Error writing %s\n", path);
+        return GL_FALSE;
+    }
+    printf("Wrote %s: %ux%u tiles of %ux%u samples, %.1f MB\n", path,
+           header.tiles_x, header.tiles_z, TILE_SAMPLES, TILE_SAMPLES,
+           (TILE_FILE_PAGE + (GLdouble)header.tiles_x * header.tiles_z * header.tile_bytes) / (1024.0 * 1024.0));
+    return GL_TRUE;
+}
+
+static const GLubyte *tile_stream_tile(const struct tile_stream *stream,
+                                       GLuint tile) {
+    return stream->mapped + TILE_FILE_PAGE + (size_t)tile * stream->header.tile_bytes;
+}
+
+/* loader thread: copy requested tiles out of the mapping until stopped */
+static void tile_stream_load(struct tile_stream *stream) {
+    for (;;) {
+        GLuint tile;
+        {
+            unique_lock<mutex> hold(stream->lock);
+            while (stream->requests.empty() && !stream->stopping)
+                stream->wake.wait(hold);
+            if (stream->stopping)
+                return;
+
+            tile = stream->requests.front();
+            stream->requests.pop_front();
+            if (stream->state[tile] != TILE_QUEUED)
+                continue;   /* a duplicate of an urgent request */
+        }
+
+        struct loaded_tile result;
+        result.tile = tile;
+        const GLubyte *source = tile_stream_tile(stream, tile);
+        result.data.assign(source, source + tile_data_bytes());
+        if (stream->latency_ms)
+            this_thread::sleep_for(chrono::milliseconds(stream->latency_ms));
+
+        unique_lock<mutex> hold(stream->lock);
+        stream->state[tile] = TILE_LOADED;
+        stream->loaded.push_back(loaded_tile());
+        stream->loaded.back().tile = tile;
+        stream->loaded.back().data.swap(result.data);
+    }
+}
+
+/* map a tile file & start the loader; budget_bytes of GPU atlas decides
+ * how many tiles can be resident at once */
+GLboolean tile_stream_open(struct tile_stream *stream,
+                           const char *path,
+                           size_t budget_bytes) {
+    stream->mapped = NULL;
+    stream->latency_ms = 0;
+    stream->fd = open(path, O_RDONLY);
+    if (stream->fd < 0) {
+        perror(path);
+        return GL_FALSE;
+    }
+
+    struct stat info;
+    if (fstat(stream->fd, &info) != 0 || (size_t)info.st_size < TILE_FILE_PAGE) {
+        fprintf(stderr, "%s: not a tile file\n", path);
+        close(stream->fd);
+        return GL_FALSE;
+    }
+    stream->mapped_bytes = info.st_size;
+    void *mapped = mmap(NULL, stream->mapped_bytes, PROT_READ, MAP_SHARED, stream->fd, 0);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        close(stream->fd);
+        return GL_FALSE;
+    }
+    stream->mapped = (const GLubyte*)mapped;
+
+    memcpy(&stream->header, stream->mapped, sizeof(stream->header));
+    GLuint num_tiles = stream->header.tiles_x * stream->header.tiles_z;
+    if (memcmp(stream->header.magic, TILE_FILE_MAGIC, sizeof(stream->header.magic)) != 0
+        || stream->header.tile_bytes < tile_data_bytes()
+        || stream->mapped_bytes < TILE_FILE_PAGE + (size_t)num_tiles * stream->header.tile_bytes) {
+        fprintf(stderr, "%s: not a tile file, or truncated\n", path);
+        munmap(mapped, stream->mapped_bytes);
+        close(stream->fd);
+        return GL_FALSE;
+    }
+
+    size_t slots = max(budget_bytes / (TILE_SAMPLES * TILE_SAMPLES * 4), (size_t)1);
+    stream->num_slots = (GLuint)min(slots, (size_t)num_tiles);
+    stream->slots_x = (GLuint)ceil(sqrt((GLdouble)stream->num_slots));
+    stream->slot_tile.assign(stream->num_slots, -1);
+    stream->slot_used.assign(stream->num_slots, 0);
+    stream->tile_slot.assign(num_tiles, -1);
+    stream->slot_heights.assign((size_t)stream->num_slots * TILE_SAMPLES * TILE_SAMPLES, 0);
+    stream->state.assign(num_tiles, TILE_ABSENT);
+    stream->tile_wanted.assign(num_tiles, 0);
+    stream->visible.clear();
+    stream->uploads.clear();
+    stream->frame = 0;
+
+    stream->tile_misses = stream->miss_frames = 0;
+    stream->tiles_loaded = stream->tiles_evicted = stream->tiles_dropped = stream->tiles_cancelled = 0;
+    stream->upload_ms = stream->max_upload_ms = 0.0;
+
+    stream->height_atlas = stream->normal_atlas = 0;
+    stream->vao = stream->patch_elements = 0;
+    stream->program = 0;
+
+    stream->requests.clear();
+    stream->loaded.clear();
+    stream->stopping = GL_FALSE;
+    stream->loader = thread(tile_stream_load, stream);
+
+    fprintf(stderr, "Streaming %s: %ux%u tiles (%.1f MB), %u resident at most (%.1f MB)\n", path,
+            stream->header.tiles_x, stream->header.tiles_z, stream->mapped_bytes / (1024.0 * 1024.0),
+            stream->num_slots, stream->num_slots * TILE_SAMPLES * TILE_SAMPLES * 4 / (1024.0 * 1024.0));
+    return GL_TRUE;
+}
+
+void tile_stream_close(struct tile_stream *stream) {
+    if (!stream->mapped)
+        return;
+
+    {
+        unique_lock<mutex> hold(stream->lock);
+        stream->stopping = GL_TRUE;
+        stream->wake.notify_one();
+    }
+    stream->loader.join();
+
+    munmap((void*)stream->mapped, stream->mapped_bytes);
+    close(stream->fd);
+    stream->mapped = NULL;
+
+    if (stream->height_atlas) {
+        glDeleteTextures(1, &stream->height_atlas);
+        glDeleteTextures(1, &stream->normal_atlas);
+        glDeleteBuffers(1, &stream->patch_elements);
+        glDeleteVertexArrays(1, &stream->vao);
+        stream->height_atlas = stream->normal_atlas = stream->patch_elements = stream->vao = 0;
+    }
+}
+
+/* tiles with any part within radius of model-space (x, z) */
+static void tile_stream_tiles_near(const struct tile_stream *stream,
+                                   glm::vec2 point,
+                                   GLfloat radius,
+                                   vector<GLuint> &tiles) {
+    const struct tile_file_header *header = &stream->header;
+    GLfloat tile_width = TILE_QUADS * header->spacing[0], tile_depth = TILE_QUADS * header->spacing[1];
+    GLfloat x = point.x - header->origin[0], z = point.y - header->origin[1];
+
+    GLint first_x = max((GLint)floor((x - radius) / tile_width), 0);
+    GLint last_x = min((GLint)floor((x + radius) / tile_width), (GLint)header->tiles_x - 1);
+    GLint first_z = max((GLint)floor((z - radius) / tile_depth), 0);
+    GLint last_z = min((GLint)floor((z + radius) / tile_depth), (GLint)header->tiles_z - 1);
+
+    GLint tx, tz;
+    for (tz = first_z; tz <= last_z; tz++) {
+        for (tx = first_x; tx <= last_x; tx++) {
+            GLfloat nearest_x = glm::clamp(x, tx * tile_width, (tx + 1) * tile_width);
+            GLfloat nearest_z = glm::clamp(z, tz * tile_depth, (tz + 1) * tile_depth);
+            if ((nearest_x - x) * (nearest_x - x) + (nearest_z - z) * (nearest_z - z) <= radius * radius)
+                tiles.push_back(tz * header->tiles_x + tx);
+        }
+    }
+}
+
+/* ask the loader for a tile; urgent ones jump the queue. Needs the lock */
+static void tile_stream_request(struct tile_stream *stream,
+                                GLuint tile,
+                                GLboolean urgent) {
+    if (stream->state[tile] == TILE_ABSENT) {
+        stream->state[tile] = TILE_QUEUED;
+        if (urgent)
+            stream->requests.push_front(tile);
+        else
+            stream->requests.push_back(tile);
+        stream->wake.notify_one();
+    }
+    else if (stream->state[tile] == TILE_QUEUED && urgent) {
+        stream->requests.push_front(tile);     /* the later copy is skipped */
+    }
+}
+
+/* give a loaded tile a slot, evicting the least recently used tile whose
+ * slot_used is below `used` (the frame for a needed tile, the frame - 1 for a
+ * prefetch, so prefetches never push out needed tiles or each other); false
+ * if there is none */
+static GLboolean tile_stream_place(struct tile_stream *stream,
+                                   struct loaded_tile *arrived,
+                                   GLuint used) {
+    GLint slot = -1;
+    GLuint oldest = used;
+    GLuint i;
+    for (i = 0; i < stream->num_slots; i++) {
+        if (stream->slot_tile[i] < 0) {
+            slot = i;
+            break;
+        }
+        if (stream->slot_used[i] < oldest) {
+            oldest = stream->slot_used[i];
+            slot = i;
+        }
+    }
+
+    unique_lock<mutex> hold(stream->lock);
+    if (slot < 0) {
+        stream->state[arrived->tile] = TILE_ABSENT;
+        stream->tiles_dropped += 1;
+        return GL_FALSE;
+    }
+
+    if (stream->slot_tile[slot] >= 0) {
+        stream->tile_slot[stream->slot_tile[slot]] = -1;
+        stream->state[stream->slot_tile[slot]] = TILE_ABSENT;
+        stream->tiles_evicted += 1;
+    }
+    stream->slot_tile[slot] = arrived->tile;
+    stream->slot_used[slot] = used;
+    stream->tile_slot[arrived->tile] = slot;
+    stream->state[arrived->tile] = TILE_RESIDENT;
+    stream->tiles_loaded += 1;
+    memcpy(&stream->slot_heights[(size_t)slot * TILE_SAMPLES * TILE_SAMPLES], &arrived->data[0],
+           TILE_SAMPLES * TILE_SAMPLES * sizeof(GLushort));
+
+    stream->uploads.push_back(loaded_tile());
+    stream->uploads.back().tile = arrived->tile;
+    stream->uploads.back().data.swap(arrived->data);
+    return GL_TRUE;
+}
+
+/* load the tiles around the camera synchronously, before the first frame */
+void tile_stream_warm(struct tile_stream *stream,
+                      glm::vec2 camera) {
+    vector<GLuint> tiles;
+    tile_stream_tiles_near(stream, camera, TILE_VIEW_RADIUS, tiles);
+
+    size_t i;
+    for (i = 0; i < tiles.size(); i++) {
+        if (stream->tile_slot[tiles[i]] >= 0)
+            continue;
+        {
+            unique_lock<mutex> hold(stream->lock);
+            if (stream->state[tiles[i]] != TILE_ABSENT)
+                continue;
+            stream->state[tiles[i]] = TILE_LOADED;
+        }
+
+        struct loaded_tile arrived;
+        arrived.tile = tiles[i];
+        const GLubyte *source = tile_stream_tile(stream, tiles[i]);
+        arrived.data.assign(source, source + tile_data_bytes());
+        tile_stream_place(stream, &arrived, stream->frame);
+    }
+}
+
+/* once a frame, with the camera & where the tour takes it next (model
+ * space x, z): place tiles the loader finished, pick this frame's visible
+ * tiles & request the rest */
+void tile_stream_update(struct tile_stream *stream,
+                        glm::vec2 camera,
+                        const glm::vec2 *upcoming,
+                        GLuint num_upcoming) {
+    stream->frame += 1;
+
+    vector<GLuint> needed, prefetch;
+    tile_stream_tiles_near(stream, camera, TILE_VIEW_RADIUS, needed);
+    GLuint i;
+    for (i = 0; i < num_upcoming; i++)
+        tile_stream_tiles_near(stream, upcoming[i], TILE_VIEW_RADIUS, prefetch);
+    sort(needed.begin(), needed.end());
+
+    /* mark what's wanted this frame, dropping repeats from prefetch (which
+     * stays soonest first, the order it's requested in) */
+    for (i = 0; i < needed.size(); i++)
+        stream->tile_wanted[needed[i]] = stream->frame;
+    GLuint kept = 0;
+    for (i = 0; i < prefetch.size(); i++) {
+        if (stream->tile_wanted[prefetch[i]] != stream->frame) {
+            stream->tile_wanted[prefetch[i]] = stream->frame;
+            prefetch[kept++] = prefetch[i];
+        }
+    }
+    prefetch.resize(kept);
+
+    /* needed tiles aren't evictable this frame; prefetched ones only to
+     * make room for needed tiles */
+    for (i = 0; i < prefetch.size(); i++)
+        if (stream->tile_slot[prefetch[i]] >= 0)
+            stream->slot_used[stream->tile_slot[prefetch[i]]] = stream->frame - 1;
+    for (i = 0; i < needed.size(); i++)
+        if (stream->tile_slot[needed[i]] >= 0)
+            stream->slot_used[stream->tile_slot[needed[i]]] = stream->frame;
+
+    deque<struct loaded_tile> arrived;
+    {
+        unique_lock<mutex> hold(stream->lock);
+        while (!stream->loaded.empty() && arrived.size() < TILE_UPLOADS_PER_FRAME) {
+            arrived.push_back(loaded_tile());
+            arrived.back().tile = stream->loaded.front().tile;
+            arrived.back().data.swap(stream->loaded.front().data);
+            stream->loaded.pop_front();
+        }
+    }
+    for (i = 0; i < arrived.size(); i++) {
+        GLboolean is_needed = binary_search(needed.begin(), needed.end(), arrived[i].tile);
+        tile_stream_place(stream, &arrived[i], is_needed ? stream->frame : stream->frame - 1);
+    }
+
+    stream->visible.clear();
+    GLuint misses = 0;
+    unique_lock<mutex> hold(stream->lock);
+
+    /* queued tiles neither needed nor ahead on the tour any more (it moved
+     * on) would only delay the ones that still matter */
+    deque<GLuint>::iterator request = stream->requests.begin();
+    while (request != stream->requests.end()) {
+        if (stream->state[*request] != TILE_QUEUED) {
+            request = stream->requests.erase(request);    /* already loaded duplicate */
+        }
+        else if (stream->tile_wanted[*request] != stream->frame) {
+            stream->state[*request] = TILE_ABSENT;
+            stream->tiles_cancelled += 1;
+            request = stream->requests.erase(request);
+        }
+        else {
+            ++request;
+        }
+    }
+
+    for (i = 0; i < needed.size(); i++) {
+        if (stream->tile_slot[needed[i]] >= 0) {
+            stream->visible.push_back(needed[i]);
+        }
+        else {
+            tile_stream_request(stream, needed[i], GL_TRUE);
+            misses += 1;
+        }
+    }
+    for (i = 0; i < prefetch.size(); i++)
+        tile_stream_request(stream, prefetch[i], GL_FALSE);
+
+    stream->tile_misses += misses;
+    if (misses)
+        stream->miss_frames += 1;
+}
+
+/* height at model-space (x, z); false off the terrain or where the tile
+ * isn't resident (anything further than TILE_VIEW_RADIUS may not be) */
+GLboolean tile_stream_height_at(const struct tile_stream *stream,
+                                GLfloat x,
+                                GLfloat z,
+                                GLfloat *height) {
+    const struct tile_file_header *header = &stream->header;
+    GLfloat gx = (x - header->origin[0]) / header->spacing[0];
+    GLfloat gz = (z - header->origin[1]) / header->spacing[1];
+    if (!(gx >= 0.0f && gz >= 0.0f && gx <= header->width - 1 && gz <= header->depth - 1))
+        return GL_FALSE;
+
+    GLuint i = min((GLuint)gx, header->width - 2), j = min((GLuint)gz, header->depth - 2);
+    GLfloat fx = gx - i, fz = gz - j;
+
+    GLint slot = stream->tile_slot[(j / TILE_QUADS) * header->tiles_x + i / TILE_QUADS];
+    if (slot < 0)
+        return GL_FALSE;
+
+    const GLushort *heights = &stream->slot_heights[(size_t)slot * TILE_SAMPLES * TILE_SAMPLES];
+    const GLushort *corner = &heights[(j % TILE_QUADS) * TILE_SAMPLES + i % TILE_QUADS];
+    GLfloat scale = header->height_scale / 65535.0f;
+
+    *height = header->height_min + scale * heightmap_interpolate(corner[0], corner[1],
+                                                                 corner[TILE_SAMPLES], corner[TILE_SAMPLES + 1],
+                                                                 fx, fz);
+    return GL_TRUE;
+}
+
+static GLboolean tile_stream_surface_height(const void *surface,
+                                            GLfloat x,
+                                            GLfloat z,
+                                            GLfloat *height) {
+    return tile_stream_height_at((const struct tile_stream*)surface, x, z, height);
+}
+
+GLboolean tile_stream_intersect_ray(const struct tile_stream *stream,
+                                    glm::vec3 origin,
+                                    glm::vec3 direction,
+                                    GLfloat max_distance,
+                                    glm::vec3 *hit) {
+    return heightmap_march_ray(tile_stream_surface_height, stream,
+                               min(stream->header.spacing[0], stream->header.spacing[1]),
+                               origin, direction, max_distance, hit);
+}
+
+/* GL side: the atlas textures (one slot per resident tile) & the patch;
+ * needs a GL context */
+GLboolean tile_stream_create_atlas(struct tile_stream *stream) {
+    GLint max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    GLuint max_slots_x = max_size / TILE_SAMPLES;
+    if (stream->slots_x > max_slots_x) {
+        stream->slots_x = max_slots_x;
+        stream->num_slots = min(stream->num_slots, max_slots_x * max_slots_x);
+        fprintf(stderr, "Tile budget cut to %u tiles (GL_MAX_TEXTURE_SIZE %d)\n", stream->num_slots, max_size);
+    }
+    GLuint slots_z = (stream->num_slots + stream->slots_x - 1) / stream->slots_x;
+
+    glGenTextures(1, &stream->height_atlas);
+    glBindTexture(GL_TEXTURE_2D, stream->height_atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, stream->slots_x * TILE_SAMPLES, slots_z * TILE_SAMPLES, 0,
+                 GL_RED, GL_UNSIGNED_SHORT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &stream->normal_atlas);
+    glBindTexture(GL_TEXTURE_2D, stream->normal_atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, stream->slots_x * TILE_SAMPLES, slots_z * TILE_SAMPLES, 0,
+                 GL_RG, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    heightmap_make_patch(&stream->vao, &stream->patch_elements, &stream->num_patch_elements);
+    stream->program = 0;
+    return GL_TRUE;
+}
+
+/* copy the tiles placed by tile_stream_update into their atlas slots */
+void tile_stream_upload(struct tile_stream *stream) {
+    if (stream->uploads.empty())
+        return;
+
+    GLdouble start = glfwGetTime();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    size_t i;
+    for (i = 0; i < stream->uploads.size(); i++) {
+        const struct loaded_tile *tile = &stream->uploads[i];
+        GLint slot = stream->tile_slot[tile->tile];
+        if (slot < 0)
+            continue;   /* evicted again by a later arrival */
+
+        GLint x = (slot % stream->slots_x) * TILE_SAMPLES, y = (slot / stream->slots_x) * TILE_SAMPLES;
+        glBindTexture(GL_TEXTURE_2D, stream->height_atlas);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, TILE_SAMPLES, TILE_SAMPLES,
+                        GL_RED, GL_UNSIGNED_SHORT, &tile->data[0]);
+        glBindTexture(GL_TEXTURE_2D, stream->normal_atlas);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, TILE_SAMPLES, TILE_SAMPLES,
+                        GL_RG, GL_UNSIGNED_BYTE, &tile->data[TILE_SAMPLES * TILE_SAMPLES * sizeof(GLushort)]);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    stream->uploads.clear();
+
+    GLdouble elapsed_ms = (glfwGetTime() - start) * 1000.0;
+    stream->upload_ms += elapsed_ms;
+    stream->max_upload_ms = max(stream->max_upload_ms, elapsed_ms);
+}
+
+static void tile_stream_find_uniforms(struct tile_stream *stream,
+                                      GLuint program) {
+    stream->program = program;
+    stream->uniforms.heights = glGetUniformLocation(program, "heights");
+    stream->uniforms.normals = glGetUniformLocation(program, "normals");
+    stream->uniforms.samples = glGetUniformLocation(program, "samples");
+    stream->uniforms.origin = glGetUniformLocation(program, "origin");
+    stream->uniforms.spacing = glGetUniformLocation(program, "spacing");
+    stream->uniforms.height_range = glGetUniformLocation(program, "height_range");
+    stream->uniforms.tex_transform = glGetUniformLocation(program, "tex_transform");
+    stream->uniforms.tiles = glGetUniformLocation(program, "tiles");
+}
+
+/* draw this frame's visible tiles, TILE_DRAW_BATCH instances per call,
+ * with the program (and its camera, light & model uniforms) bound */
+void tile_stream_draw(struct tile_stream *stream,
+                      GLuint program) {
+    if (stream->program != program)
+        tile_stream_find_uniforms(stream, program);
+
+    const struct tile_file_header *header = &stream->header;
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, stream->height_atlas);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, stream->normal_atlas);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform1i(stream->uniforms.heights, 1);
+    glUniform1i(stream->uniforms.normals, 2);
+    glUniform2i(stream->uniforms.samples, header->width, header->depth);
+    glUniform2fv(stream->uniforms.origin, 1, header->origin);
+    glUniform2fv(stream->uniforms.spacing, 1, header->spacing);
+    glUniform2f(stream->uniforms.height_range, header->height_min, header->height_scale);
+    glUniformMatrix3fv(stream->uniforms.tex_transform, 1, GL_FALSE, header->tex_transform);
+
+    glBindVertexArray(stream->vao);
+
+    /* per instance: tile (x, z) in the terrain & its slot (x, z) in the atlas */
+    GLint tiles[TILE_DRAW_BATCH * 4];
+    size_t first, i;
+    for (first = 0; first < stream->visible.size(); first += TILE_DRAW_BATCH) {
+        GLuint batch = (GLuint)min(stream->visible.size() - first, (size_t)TILE_DRAW_BATCH);
+        for (i = 0; i < batch; i++) {
+            GLuint tile = stream->visible[first + i];
+            GLint slot = stream->tile_slot[tile];
+            tiles[i*4] = tile % header->tiles_x;
+            tiles[i*4+1] = tile / header->tiles_x;
+            tiles[i*4+2] = slot % stream->slots_x;
+            tiles[i*4+3] = slot / stream->slots_x;
+        }
+        glUniform4iv(stream->uniforms.tiles, batch, tiles);
+        glDrawElementsInstanced(GL_TRIANGLES, stream->num_patch_elements, GL_UNSIGNED_SHORT,
+                                (void*)0, batch);
+    }
+    glBindVertexArray(0);
+}
+
+void tile_stream_report(const struct tile_stream *stream,
+                        FILE *out) {
+    GLuint resident = 0, i;
+    for (i = 0; i < stream->num_slots; i++)
+        resident += stream->slot_tile[i] >= 0;
+
+    fprintf(out, "tiles: %u/%u resident (%u visible), %u loaded, %u evicted, %u dropped, "
+                 "%u prefetches cancelled, %u misses in %u of %u frames, upload %.3f ms/frame (max %.3f)\n",
+            resident, stream->num_slots, (GLuint)stream->visible.size(),
+            stream->tiles_loaded, stream->tiles_evicted, stream->tiles_dropped, stream->tiles_cancelled,
+            stream->tile_misses, stream->miss_frames, stream->frame,
+            stream->frame ? stream->upload_ms / stream->frame : 0.0, stream->max_upload_ms);
+}
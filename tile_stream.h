@@ -0,0 +1,135 @@
+#define TILE_QUADS HEIGHTMAP_PATCH_QUADS   /* a tile is drawn as one heightmap patch */
+#define TILE_SAMPLES (TILE_QUADS + 1)       /* per side; edge samples are repeated in the neighbour */
+#define TILE_FILE_PAGE 4096                 /* the header & every tile start on a page boundary */
+#define TILE_FILE_MAGIC "MARSTIL1"
+#define TILE_STREAM_BUDGET_MB 8             /* default GPU residency budget */
+#define TILE_VIEW_RADIUS 20.0               /* tiles this close to the camera are drawn (the far plane) */
+#define TILE_PREFETCH_SECONDS 4.0           /* how far ahead along the tour to prefetch */
+#define TILE_PREFETCH_STEP 0.25             /* seconds between the tour positions prefetched around */
+#define TILE_UPLOADS_PER_FRAME 16
+#define TILE_DRAW_BATCH 64                  /* TILE_BATCH in vert_tiles.glsl */
+
+enum tile_state {
+    TILE_ABSENT,
+    TILE_QUEUED,                    /* waiting for the loader thread */
+    TILE_LOADED,                    /* read, waiting to be given a slot */
+    TILE_RESIDENT                   /* in a slot of the atlas */
+};
+
+/* structure definitions */
+
+/* start of a tile file; tile (x, z) follows at page (1 + z*tiles_x + x) *
+ * tile_bytes / TILE_FILE_PAGE, as TILE_SAMPLES^2 heights then as many
+ * normals (see struct heightmap for the encoding) */
+struct tile_file_header {
+    char magic[8];
+    GLuint tiles_x, tiles_z;
+    GLuint width, depth;            /* samples in the whole terrain */
+    GLuint tile_bytes;              /* per tile, rounded up to whole pages */
+    GLfloat origin[2];
+    GLfloat spacing[2];
+    GLfloat height_min, height_scale;
+    GLfloat tex_transform[9];
+};
+
+struct loaded_tile {
+    GLuint tile;
+    std::vector<GLubyte> data;      /* as in the file */
+};
+
+/* terrain too large to keep in memory, read from a memory-mapped tile file
+ * by a loader thread and kept in a fixed budget of atlas slots on the GPU,
+ * least recently used first out. The caller says where the camera is and
+ * will be (the tour is known ahead), so tiles arrive before they're needed;
+ * any that don't are counted as misses */
+struct tile_stream {
+    int fd;
+    const GLubyte *mapped;
+    size_t mapped_bytes;
+    struct tile_file_header header;
+
+    /* residency (render thread only, except state) */
+    GLuint num_slots;
+    GLuint slots_x;                 /* atlas is slots_x x ceil(num_slots / slots_x) tiles */
+    std::vector<GLint> slot_tile;   /* tile in each slot, -1 if free */
+    std::vector<GLuint> slot_used;  /* frame each slot's tile was last needed (frame - 1 if prefetched) */
+    std::vector<GLint> tile_slot;   /* slot of each tile, -1 if not resident */
+    std::vector<GLushort> slot_heights; /* TILE_SAMPLES^2 per slot, kept for height queries */
+    std::vector<GLuint> tile_wanted;    /* frame each tile was last needed or prefetched */
+    std::vector<GLubyte> state;     /* enum tile_state, guarded by lock */
+    std::vector<GLuint> visible;    /* resident tiles to draw this frame */
+    std::vector<struct loaded_tile> uploads;   /* given a slot, waiting for tile_stream_upload */
+    GLuint frame;
+
+    /* loader thread */
+    std::thread loader;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<GLuint> requests;    /* needed now at the front, prefetches at the back */
+    std::deque<struct loaded_tile> loaded;
+    GLboolean stopping;
+    GLuint latency_ms;              /* added to every load, to simulate slow storage (bench.cpp) */
+
+    /* GL objects (tile_stream_create_atlas) */
+    GLuint height_atlas;            /* GL_R16 */
+    GLuint normal_atlas;            /* GL_RG8 */
+    GLuint vao;
+    GLuint patch_elements;
+    GLuint num_patch_elements;
+
+    GLuint program;                 /* program the uniforms below belong to */
+    struct {
+        GLint heights;
+        GLint normals;
+        GLint samples;
+        GLint origin;
+        GLint spacing;
+        GLint height_range;
+        GLint tex_transform;
+        GLint tiles;
+    } uniforms;
+
+    /* instrumentation */
+    GLuint tile_misses;             /* needed tiles that weren't resident, summed over frames */
+    GLuint miss_frames;             /* frames drawn with tiles missing */
+    GLuint tiles_loaded;
+    GLuint tiles_evicted;
+    GLuint tiles_dropped;           /* loaded with no slot to evict (all needed, or prefetched too for a prefetch) */
+    GLuint tiles_cancelled;         /* queued prefetches dropped once the tour no longer led there */
+    GLdouble upload_ms;             /* total time in tile_stream_upload */
+    GLdouble max_upload_ms;
+};
+
+/* function prototypes */
+GLboolean tile_file_write(const struct heightmap *map,
+                          const char *path);
+
+GLboolean tile_stream_open(struct tile_stream *stream,
+                           const char *path,
+                           size_t budget_bytes);
+void tile_stream_close(struct tile_stream *stream);
+
+void tile_stream_warm(struct tile_stream *stream,
+                      glm::vec2 camera);
+void tile_stream_update(struct tile_stream *stream,
+                        glm::vec2 camera,
+                        const glm::vec2 *upcoming,
+                        GLuint num_upcoming);
+
+GLboolean tile_stream_height_at(const struct tile_stream *stream,
+                                GLfloat x,
+                                GLfloat z,
+                                GLfloat *height);
+GLboolean tile_stream_intersect_ray(const struct tile_stream *stream,
+                                    glm::vec3 origin,
+                                    glm::vec3 direction,
+                                    GLfloat max_distance,
+                                    glm::vec3 *hit);
+
+GLboolean tile_stream_create_atlas(struct tile_stream *stream);
+void tile_stream_upload(struct tile_stream *stream);
+void tile_stream_draw(struct tile_stream *stream,
+                      GLuint program);
+
+void tile_stream_report(const struct tile_stream *stream,
+                        FILE *out);
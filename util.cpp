@@ -9,10 +9,17 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <map>
+#include <string>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 
 #include "util.h"
+#include "scene_store.h"
+#include "mesh_arena.h"
+#include "texture_array.h"
+#include "resources.h"
 
 using namespace std;
 
@@ -42,15 +49,30 @@ void *file_contents(const char *filename, GLint *length)
     return buffer;
 }
 
+/* FNV-1a; chain calls by passing the previous result as `hash` */
+GLuint64 hash_bytes(const void *data, size_t length, GLuint64 hash) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t i;
+    
+    for (i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;   /* FNV prime */
+    }
+    
+    return hash;
+}
+
 // load Wavefront (.obj) files into vertices/normals for OpenGL
 // derived from code found here: http://en.wikibooks.org/wiki/OpenGL_Programming/Modern_OpenGL_Tutorial_Load_OBJ
-// but with texture (UV) co-ordinate handling & comments added
-void load_obj(const char* filename,
-              vector<glm::vec3> &vertices,
-              vector<glm::vec2> &tex_coords,
-              vector<glm::vec3> &normals,
-              vector<GLushort> &elements,
-              GLboolean has_texture) {
+// but with texture (UV) co-ordinate handling & comments added.
+// Returns GL_FALSE (having said why) if the file can't be opened, has more
+// vertices than GLushort indices reach or a face refers to one it lacks
+GLboolean load_obj(const char* filename,
+                   vector<glm::vec3> &vertices,
+                   vector<glm::vec2> &tex_coords,
+                   vector<glm::vec3> &normals,
+                   vector<GLushort> &elements,
+                   GLboolean has_texture) {
     
     // .obj file is nice to parse: process line-by-line:
     // v ... space-separated vertex co-ordinates
@@ -58,7 +80,7 @@ void load_obj(const char* filename,
     
     // load file as input stream; fail if it doesn't work
     ifstream in(filename, ios::in);
-    if (!in) { cerr << "Cannot open " << filename << endl; exit(1); }
+    if (!in) { cerr << "Cannot open " << filename << endl; return GL_FALSE; }
     
     // process line by line...
     string line;
@@ -79,6 +101,10 @@ void load_obj(const char* filename,
             
             // add to the end of the vertices vector
             vertices.push_back(v);
+            if (vertices.size() > OBJ_MAX_VERTICES) {
+                cerr << filename << " has over " << OBJ_MAX_VERTICES << " vertices" << endl;
+                return GL_FALSE;
+            }
         }
         
         // texture co-ordinate
@@ -107,22 +133,32 @@ void load_obj(const char* filename,
             while (s >> face_str) {
                 istringstream nums(face_str);
                 
-                GLushort mesh_elem;
-                GLushort tex_elem;
+                GLuint mesh_elem = 0;
+                GLuint tex_elem = 0;
                 
                 nums >> mesh_elem;
                 if(has_texture) {
                     nums.ignore();  // ignore slash
                     nums >> tex_elem;
-                    tex_elem--;
+                }
+                
+                // 1-indexed, and only vertices (& tex co-ordinates) seen so far
+                if (!nums || mesh_elem < 1 || mesh_elem > vertices.size()
+                    || (has_texture && (tex_elem < 1 || tex_elem > tex_vertices.size()))) {
+                    cerr << filename << ": bad face \"" << line << "\"" << endl;
+                    return GL_FALSE;
                 }
                 
                 mesh_elem--;
+                tex_elem--;
                 
-                elements.push_back(mesh_elem);
+                elements.push_back((GLushort)mesh_elem);
                 
-                if (has_texture)
+                if (has_texture) {
+                    if (tex_coords.size() < vertices.size())
+                        tex_coords.resize(vertices.size(), glm::vec2(0.0, 0.0));
                     tex_coords[mesh_elem] = tex_vertices[tex_elem];
+                }
             }
         }
         else {
@@ -130,9 +166,17 @@ void load_obj(const char* filename,
         }
     }
     
-    // calculate normals
+    mesh_generate_normals(vertices, elements, normals);
+    return GL_TRUE;
+}
+
+/* per-vertex normals: each vertex takes the face normal of the last
+ * triangle using it */
+void mesh_generate_normals(const vector<glm::vec3> &vertices,
+                           const vector<GLushort> &elements,
+                           vector<glm::vec3> &normals) {
     normals.resize(vertices.size(), glm::vec3(0.0, 0.0, 0.0));
-    for (GLuint i = 0; i < elements.size(); i+=3) {
+    for (GLuint i = 0; i + 2 < elements.size(); i+=3) {
         GLushort ia = elements[i];
         GLushort ib = elements[i+1];
         GLushort ic = elements[i+2];
@@ -142,10 +186,28 @@ void load_obj(const char* filename,
     }
 }
 
+/* load_obj into a mesh_data, replacing what it held (left empty if the
+ * file can't be loaded) */
+GLboolean load_mesh(const char *filename,
+                    struct mesh_data *mesh,
+                    GLboolean has_texture) {
+    *mesh = mesh_data();
+    if (load_obj(filename,
+                 mesh->vertices,
+                 mesh->tex_coords,
+                 mesh->normals,
+                 mesh->elements,
+                 has_texture))
+        return GL_TRUE;
+    
+    *mesh = mesh_data();
+    return GL_FALSE;
+}
+
 /* helper function to generate, bind and populate a buffer */
-static GLuint make_buffer(GLenum target,
-                          const void *buffer_data,
-                          unsigned long buffer_size) {
+GLuint make_buffer(GLenum target,
+                   const void *buffer_data,
+                   unsigned long buffer_size) {
     GLuint buffer;
     
     glGenBuffers(1, &buffer); /* generate 1 buffer object name */
@@ -173,30 +235,23 @@ static void show_info_log(
     free(log);
 }
 
-/* loads and compiles a shader */
-static GLuint make_shader(GLenum type,
-                          const char *filename) {
-    GLint length;
+/* compiles a shader from source; name is only used in error messages */
+GLuint make_shader(GLenum type,
+                   const GLchar *source,
+                   GLint length,
+                   const char *name) {
     GLuint shader;
     GLint shader_ok;
     
-    /* load shader from file */
-    GLchar *source = (GLchar *)file_contents(filename, &length);
-    
-    
-    if(!source) /* file loading error */
-        return 0;
-    
     /* create & compile shader */
     shader = glCreateShader(type);
-    glShaderSource(shader, 1, (const GLchar**)&source, &length);
-    free(source);
+    glShaderSource(shader, 1, &source, &length);
     glCompileShader(shader);
     
     /* check shader compilation */
     glGetShaderiv(shader, GL_COMPILE_STATUS, &shader_ok);
     if(!shader_ok) {
-        fprintf(stderr, "Failed to compile %s: \n", filename);
+        fprintf(stderr, "Failed to compile %s: \n", name);
         show_info_log(shader, glGetShaderiv, glGetShaderInfoLog);
         glDeleteShader(shader);
         return 0;
@@ -206,8 +261,8 @@ static GLuint make_shader(GLenum type,
 }
 
 /* attach & link shaders to a program */
-static GLuint make_program(GLuint vertex_shader,
-                           GLuint fragment_shader) {
+GLuint make_program(GLuint vertex_shader,
+                    GLuint fragment_shader) {
     GLint program_ok;
     GLuint program = glCreateProgram();
     
@@ -216,6 +271,15 @@ static GLuint make_program(GLuint vertex_shader,
     
     /* fragment shader */
     glAttachShader(program, fragment_shader);
+    
+    /* fixed attribute locations & out colour variable; only take effect at link time */
+    glBindAttribLocation(program, ATTRIB_POSITION, "in_Position");
+    glBindAttribLocation(program, ATTRIB_NORMAL, "in_Normal");
+    glBindAttribLocation(program, ATTRIB_TEXCOORD, "in_TexCoord");
+    glBindAttribLocation(program, ATTRIB_BAKED, "in_Baked");
+    glBindAttribLocation(program, ATTRIB_DRAW_ID, "in_DrawID");
+    glBindFragDataLocation(program, 0, "fragmentColour");
+    
     glLinkProgram(program);
     
     /* check shaders correctly linked */
@@ -230,77 +294,72 @@ static GLuint make_program(GLuint vertex_shader,
     return program;
 }
 
-/* generate all necessary resources */
-int make_model(struct model *resources,
-                       const char *obj_path,
-                       const char *vertex_shader_path,
-                       const char *fragment_shader_path,
-                       const char *texture_path
-                       ) {
-    /* texture */
-    if(texture_path) {
-        glGenTextures(1, &(resources->texture));
-        glBindTexture(GL_TEXTURE_2D, resources->texture);
-        glfwLoadTexture2D( texture_path, 0);
+static int model_find_uniforms(struct model *resources);
+
+/* does the program's "tex" uniform sample a texture array? */
+static GLboolean program_samples_array(GLuint program) {
+    const GLchar *tex_name = "tex";
+    GLuint tex_index;
+    GLint type;
+    glGetUniformIndices(program, 1, &tex_name, &tex_index);
+    if (tex_index == GL_INVALID_INDEX)
+        return GL_FALSE;
+    
+    glGetActiveUniformsiv(program, 1, &tex_index, GL_UNIFORM_TYPE, &type);
+    return type == GL_SAMPLER_2D_ARRAY;
+}
+
+/* generate all necessary resources (shared with other models where possible) */
+int make_model(struct resource_manager *manager,
+               struct model *resources,
+               const char *obj_path,
+               const struct mesh_data *obj_mesh,
+               const char *vertex_shader_path,
+               const char *fragment_shader_path,
+               const char *texture_path
+               ) {
+    /* vertices & indices (in the shared mesh arena), from obj_path as
+     * parsed into obj_mesh (or parsed here if NULL); none for models that
+     * generate their geometry in the shader (heightmap terrain) */
+    if (obj_path) {
+        resources->handles.mesh = resource_mesh(manager, obj_path, texture_path != NULL, obj_mesh);
+        if (resources->handles.mesh == 0)
+            return 0;
         
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        const struct resource *mesh = resource_get(manager, resources->handles.mesh);
+        resources->vao = mesh->object;
+        resources->first_vertex = mesh->first_vertex;
+        resources->first_index = mesh->first_index;
+        resources->num_drawn_vertices = mesh->num_elements;
     }
     
-    /* vertex array object */
-    glGenVertexArrays(1, &(resources->vao));
-    glBindVertexArray(resources->vao);
-    
-    vector<glm::vec3> mesh_vertices;
-    vector<glm::vec2> tex_coords;
-    vector<glm::vec3> mesh_normals;
-    vector<GLushort> mesh_elements;
-    
-    load_obj(obj_path,
-             mesh_vertices,
-             tex_coords,
-             mesh_normals,
-             mesh_elements,
-             texture_path != NULL);
-    
-    resources->vertex_buffer = make_buffer(GL_ARRAY_BUFFER,
-                                           &mesh_vertices[0],
-                                           sizeof(glm::vec3) * mesh_vertices.size());
-    
-    resources->normal_buffer = make_buffer(GL_ARRAY_BUFFER,
-                                           &mesh_normals[0],
-                                           sizeof(glm::vec3) * mesh_normals.size());
-    
-    resources->num_drawn_vertices = mesh_elements.size();
-    
-    resources->element_buffer = make_buffer(GL_ELEMENT_ARRAY_BUFFER,
-                                            &mesh_elements[0],
-                                            sizeof(GLushort) * resources->num_drawn_vertices);
-    if(texture_path) {
-        resources->texcoord_buffer = make_buffer(GL_ARRAY_BUFFER,
-                                                 &tex_coords[0],
-                                                 sizeof(glm::vec2) * tex_coords.size());
-    }
-    
-    /* make vertex shaders */
-    resources->vertex_shader = make_shader(GL_VERTEX_SHADER, vertex_shader_path);
-    if (resources->vertex_shader == 0)
-        return 0;
-    
-    /* make fragment shader */
-    resources->fragment_shader = make_shader(GL_FRAGMENT_SHADER, fragment_shader_path);
-    
-    if (resources->fragment_shader == 0)
-        return 0;
-    
-    /* make program */
-    resources->program = make_program(resources->vertex_shader,
-                                      resources->fragment_shader);
-    if(resources->program == 0)
+    /* make program (and its vertex & fragment shaders) */
+    resources->handles.program = resource_program(manager, vertex_shader_path, fragment_shader_path);
+    if(resources->handles.program == 0)
         return 0;
+    resources->program = resource_get(manager, resources->handles.program)->object;
+    
+    /* texture: a layer of a texture array if the program samples one (solid
+     * white for untextured models, so they can share its passes), else its own */
+    resources->texture_target = GL_TEXTURE_2D;
+    resources->layer = 0;
+    if (program_samples_array(resources->program)) {
+        resources->texture_target = GL_TEXTURE_2D_ARRAY;
+        if (!texture_arrays_add(&manager->arrays, texture_path, &resources->texture, &resources->layer))
+            return 0;
+    }
+    else if(texture_path) {
+        resources->handles.texture = resource_texture(manager, texture_path);
+        if (resources->handles.texture == 0)
+            return 0;
+        resources->texture = resource_get(manager, resources->handles.texture)->object;
+    }
     
+    return model_find_uniforms(resources);
+}
+
+/* look up the uniform locations of a model's program */
+static int model_find_uniforms(struct model *resources) {
     /* setup shader uniforms (MVP matrix & texture) */
     resources->uniforms.model = glGetUniformLocation(resources->program, "model");
     if(resources->uniforms.model == -1)
@@ -311,15 +370,25 @@ int make_model(struct model *resources,
     resources->uniforms.projection = glGetUniformLocation(resources->program, "projection");
     if(resources->uniforms.projection == -1)
         return 0;
+    /* optional: shaders using baked lighting have no use for normals */
     resources->uniforms.model_inv = glGetUniformLocation(resources->program, "model_inv");
-    if(resources->uniforms.model_inv == -1)
-        return 0;
     
-    if (texture_path) {
+    /* programs declaring model[] (indexed by in_DrawID) can draw several models at once */
+    const GLchar *model_name = "model";
+    GLuint model_index;
+    resources->batch_size = 1;
+    glGetUniformIndices(resources->program, 1, &model_name, &model_index);
+    if (model_index != GL_INVALID_INDEX)
+        glGetActiveUniformsiv(resources->program, 1, &model_index, GL_UNIFORM_SIZE, &resources->batch_size);
+    
+    if (resources->texture) {
         resources->uniforms.texture = glGetUniformLocation(resources->program, "tex");
         if(resources->uniforms.texture == -1)
             return 0;
     }
+    resources->uniforms.layer = glGetUniformLocation(resources->program, "layer");
+    
+    resources->uniforms.ambient = glGetUniformLocation(resources->program, "material.ambient");
     
     /* setup lighting uniforms: all lights on this scene */
     int light_idx;
@@ -341,52 +410,99 @@ int make_model(struct model *resources,
                                                                         attenuation_uniform_name);
     }
     
-    /* setup shader attributes */
-    resources->attributes.position = glGetAttribLocation(resources->program, "in_Position");
-    resources->attributes.normal = glGetAttribLocation(resources->program, "in_Normal");
-    
-    if(texture_path)
-        resources->attributes.texcoord = glGetAttribLocation(resources->program, "in_TexCoord");
-    
-    /* add out colour variable to fragment shader */
-    glBindFragDataLocation(resources->program, 0, "fragment_Colour");
-    
-    /* set vertex attributes (positions) */
-    glBindBuffer(GL_ARRAY_BUFFER, resources->vertex_buffer);
-    glEnableVertexAttribArray(resources->attributes.position);
-    glVertexAttribPointer(
-                          resources->attributes.position,  /* attribute */
-                          3,                                /* size */
-                          GL_FLOAT,                         /* type */
-                          GL_FALSE,                         /* normalized? */
-                          0,                                /* stride */
-                          (void*)0                          /* array buffer offset */
-                          );
-    
-    /* set vertex attributes (normals) */
-    glBindBuffer(GL_ARRAY_BUFFER, resources->normal_buffer);
-    glEnableVertexAttribArray(resources->attributes.normal);
-    glVertexAttribPointer(
-                          resources->attributes.normal,  /* attribute */
-                          3,                                /* size */
-                          GL_FLOAT,                         /* type */
-                          GL_FALSE,                         /* normalized? */
-                          0,                                /* stride */
-                          (void*)0                          /* array buffer offset */
-                          );
-    
-    if (texture_path) {
-        /* set texture coordinates */
-        glBindBuffer(GL_ARRAY_BUFFER, resources->texcoord_buffer);
-        glEnableVertexAttribArray(resources->attributes.texcoord);
-        glVertexAttribPointer(
-                              resources->attributes.texcoord,  /* attribute */
-                              2,                                /* size */
-                              GL_FLOAT,                         /* type */
-                              GL_FALSE,                         /* normalized? */
-                              0,                                /* stride */
-                              (void*)0                          /* array buffer offset */
-                              );
-    }
     return 1;
-}
\ No newline at end of file
+}
+
+/* pick up new GL objects after the model's resources were reloaded. If
+ * its mesh was, *mesh_changed is set and (unless cpu_mesh is NULL)
+ * *cpu_mesh becomes the new CPU copy. 0 if the model can't be drawn any
+ * more (e.g. a reloaded shader lost a uniform it needs) */
+int model_refresh(struct resource_manager *manager,
+                  struct model *resources,
+                  struct mesh_data *cpu_mesh,
+                  GLboolean *mesh_changed) {
+    struct mesh_data unwanted;
+    *mesh_changed = resource_take_reloaded_mesh(manager, resources->handles.mesh,
+                                                cpu_mesh ? cpu_mesh : &unwanted);
+    
+    const struct resource *mesh = resource_get(manager, resources->handles.mesh);
+    const struct resource *program = resource_get(manager, resources->handles.program);
+    const struct resource *texture = resource_get(manager, resources->handles.texture);
+    
+    if ((resources->handles.mesh && !mesh) || !program)
+        return 0;
+    
+    if (mesh) {
+        resources->vao = mesh->object;
+        resources->first_vertex = mesh->first_vertex;
+        resources->first_index = mesh->first_index;
+        resources->num_drawn_vertices = mesh->num_elements;
+    }
+    if (resources->texture_target != GL_TEXTURE_2D_ARRAY)
+        resources->texture = texture ? texture->object : 0;
+    
+    if (resources->program == program->object)
+        return 1;
+    
+    resources->program = program->object;
+    return model_find_uniforms(resources);
+}
+
+/* give back a model's references to its shared resources */
+void model_release(struct resource_manager *manager,
+                   struct model *resources) {
+    resource_release(manager, resources->handles.mesh);
+    resource_release(manager, resources->handles.texture);
+    resource_release(manager, resources->handles.program);
+    
+    resources->handles.mesh = resources->handles.texture = resources->handles.program = 0;
+    resources->vao = resources->texture = resources->program = 0;
+}
+
+/* order models so that those sharing program, texture & material are adjacent
+ * (models with layers of the same texture array share a pass) */
+bool model_pass_before(const struct model *a, const struct model *b) {
+    if (a->program != b->program)
+        return a->program < b->program;
+    if (a->texture != b->texture)
+        return a->texture < b->texture;
+    if (a->material.ambient.x != b->material.ambient.x)
+        return a->material.ambient.x < b->material.ambient.x;
+    if (a->material.ambient.y != b->material.ambient.y)
+        return a->material.ambient.y < b->material.ambient.y;
+    return a->material.ambient.z < b->material.ambient.z;
+}
+
+/* sort models into passes; walk them with model_pass_end */
+void model_sort_passes(struct model **models,
+                       GLuint count) {
+    sort(models, models + count, model_pass_before);
+}
+
+/* one past the last model of the pass starting at `first` */
+GLuint model_pass_end(struct model *const *models,
+                      GLuint first,
+                      GLuint count) {
+    GLuint i;
+    for (i = first + 1; i < count; i++) {
+        if (model_pass_before(models[first], models[i]))
+            break;
+    }
+    return i;
+}
+
+/* per-draw uniforms of one multi-draw batch: model & normal matrices
+ * (cached by scene_store_update) and texture array layers, indexed by in_DrawID */
+void model_batch_uniforms(const struct scene_store *store,
+                          struct model *const *models,
+                          GLuint count,
+                          glm::mat4 *model_matrices,
+                          glm::mat3 *normal_matrices,
+                          GLint *layers) {
+    GLuint i;
+    for (i = 0; i < count; i++) {
+        model_matrices[i] = store->world_matrices[models[i]->entity];
+        normal_matrices[i] = store->normal_matrices[models[i]->entity];
+        layers[i] = models[i]->layer;
+    }
+}
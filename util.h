@@ -1,6 +1,18 @@
 #define MAX_LIGHTS 8
 #define MAX_CAMERA_ACTIONS 5
 
+/* fixed vertex attribute locations, bound before linking every program so
+ * that one mesh VAO works with any program */
+#define ATTRIB_POSITION 0
+#define ATTRIB_NORMAL 1
+#define ATTRIB_TEXCOORD 2
+#define ATTRIB_BAKED 3
+#define ATTRIB_DRAW_ID 4    /* index of the draw within a multi-draw call (see mesh_arena.h) */
+
+#define HASH_SEED 14695981039346656037ULL   /* FNV-1a offset basis */
+
+#define OBJ_MAX_VERTICES 65536      /* element indices are GLushort */
+
 /* structure definitions */
 struct LightSource {
     glm::vec4 position;
@@ -9,25 +21,25 @@ struct LightSource {
 };
 
 struct model {
-    GLuint vao;
-    GLuint vertex_buffer;
-    GLuint normal_buffer;
-    GLuint element_buffer;
-    GLuint texcoord_buffer;
+    /* shared resources (see resources.h); the GL names below are copies */
+    struct {
+        GLuint mesh;
+        GLuint texture;
+        GLuint program;
+    } handles;
+    
+    GLuint vao;             /* the mesh arena's, shared by every model */
+    GLuint first_vertex;    /* where the mesh lives in the arena */
+    GLuint first_index;
     
     GLuint texture;
+    GLenum texture_target;  /* GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY (see texture_array.h) */
+    GLint layer;            /* of the texture array */
     
-    GLuint vertex_shader;
-    GLuint fragment_shader;
     GLuint program;
     
     GLulong num_drawn_vertices;
     
-    GLboolean earthquake_on;
-    GLfloat earthquake_duration;
-    GLfloat earthquake_elapsed;
-    GLfloat earthquake_amplitude;
-    
     struct {
         GLint model;
         GLint view;
@@ -37,18 +49,15 @@ struct model {
         GLint ambient;
         
         GLint texture;
+        GLint layer;        /* layer[], indexed by in_DrawID like model[] */
     } uniforms;
     
+    GLint batch_size;       /* length of the program's model[] array: draws per multi-draw */
+    
     struct {
         glm::vec3 ambient;
     } material;
     
-    struct {
-        GLint position;
-        GLint normal;
-        GLint texcoord;
-    } attributes;
-    
     struct light {
         struct LightSource *source;
         GLint position;
@@ -58,7 +67,22 @@ struct model {
     
     struct light lights[MAX_LIGHTS];
     
-    glm::vec3 position;
+    GLuint entity;  /* transform lives in the scene store */
+};
+
+/* CPU copy of a mesh, as loaded from an .obj file */
+struct mesh_data {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> tex_coords;
+    std::vector<glm::vec3> normals;
+    std::vector<GLushort> elements;
+};
+
+struct earthquake {
+    GLboolean on;
+    GLfloat duration;
+    GLfloat elapsed;
+    GLfloat amplitude;
 };
 
 struct scene {
@@ -95,10 +119,63 @@ struct camera {
     struct stage tour[MAX_CAMERA_ACTIONS];
 };
 
+struct resource_manager;
+struct scene_store;
+
 /* function prototypes */
-int make_model(struct model *resources,
+int make_model(struct resource_manager *manager,
+               struct model *resources,
                const char *obj_path,
+               const struct mesh_data *obj_mesh,
                const char *vertex_shader_path,
                const char *fragment_shader_path,
                const char *texture_path
-               );
\ No newline at end of file
+               );
+
+GLboolean load_obj(const char* filename,
+                   std::vector<glm::vec3> &vertices,
+                   std::vector<glm::vec2> &tex_coords,
+                   std::vector<glm::vec3> &normals,
+                   std::vector<GLushort> &elements,
+                   GLboolean has_texture);
+
+int model_refresh(struct resource_manager *manager,
+                  struct model *resources,
+                  struct mesh_data *cpu_mesh,
+                  GLboolean *mesh_changed);
+GLboolean load_mesh(const char *filename,
+                    struct mesh_data *mesh,
+                    GLboolean has_texture);
+void mesh_generate_normals(const std::vector<glm::vec3> &vertices,
+                           const std::vector<GLushort> &elements,
+                           std::vector<glm::vec3> &normals);
+
+void model_release(struct resource_manager *manager,
+                   struct model *resources);
+
+bool model_pass_before(const struct model *a,
+                       const struct model *b);
+void model_sort_passes(struct model **models,
+                       GLuint count);
+GLuint model_pass_end(struct model *const *models,
+                      GLuint first,
+                      GLuint count);
+void model_batch_uniforms(const struct scene_store *store,
+                          struct model *const *models,
+                          GLuint count,
+                          glm::mat4 *model_matrices,
+                          glm::mat3 *normal_matrices,
+                          GLint *layers);
+
+void *file_contents(const char *filename, GLint *length);
+GLuint64 hash_bytes(const void *data, size_t length, GLuint64 hash);
+
+GLuint make_buffer(GLenum target,
+                   const void *buffer_data,
+                   unsigned long buffer_size);
+GLuint make_shader(GLenum type,
+                   const GLchar *source,
+                   GLint length,
+                   const char *name);
+GLuint make_program(GLuint vertex_shader,
+                    GLuint fragment_shader);
@@ -0,0 +1,24 @@
+#version 150
+
+#define MAX_DRAWS 16    // ARENA_MAX_DRAWS
+
+uniform mat4 model[MAX_DRAWS];
+uniform int layer[MAX_DRAWS];   // texture array layer of each model (frag_baked_array.glsl)
+uniform mat4 view;
+uniform mat4 projection;
+
+in vec3 in_Position;
+in vec2 in_TexCoord;
+in vec4 in_Baked;   // rgb = direct diffuse light, a = ambient occlusion
+in int in_DrawID;   // which model of a multi-draw this vertex belongs to
+
+out vec2 out_TexCoord;
+out vec4 out_Baked;
+flat out int out_Layer;
+
+void main() {
+    gl_Position = projection * view * model[in_DrawID] * vec4(in_Position, 1.0);
+    out_TexCoord = in_TexCoord;
+    out_Baked = in_Baked;
+    out_Layer = layer[in_DrawID];
+}
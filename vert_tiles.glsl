@@ -0,0 +1,40 @@
+#version 150
+
+#define PATCH_QUADS 64  // TILE_QUADS
+#define TILE_BATCH 64   // TILE_DRAW_BATCH
+
+// streamed terrain tiles (see tile_stream.cpp): like vert_heightmap.glsl,
+// but each instance is one tile, read from its slot of the atlas
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform sampler2D heights;      // atlas, R16: 0..1 across height_range
+uniform sampler2D normals;      // atlas, RG8: normal.xz * 0.5 + 0.5
+uniform ivec2 samples;          // size of the whole terrain
+uniform vec2 origin;            // model-space (x, z) of sample (0, 0)
+uniform vec2 spacing;
+uniform vec2 height_range;      // x = lowest height, y = highest - lowest
+uniform mat3 tex_transform;     // (x, z, 1) -> uv
+uniform ivec4 tiles[TILE_BATCH];    // xy = tile in the terrain, zw = slot in the atlas
+
+out vec4 out_Position;
+out vec3 out_Normal;
+out vec2 out_TexCoord;
+
+void main() {
+    ivec4 tile = tiles[gl_InstanceID];
+    ivec2 local = ivec2(gl_VertexID % (PATCH_QUADS + 1), gl_VertexID / (PATCH_QUADS + 1));
+    ivec2 texel = tile.zw * (PATCH_QUADS + 1) + local;
+    ivec2 grid = min(tile.xy * PATCH_QUADS + local, samples - 1);  // tiles overhanging the edge collapse
+
+    float height = height_range.x + texelFetch(heights, texel, 0).r * height_range.y;
+    vec2 normal_xz = texelFetch(normals, texel, 0).rg * 2.0 - 1.0;
+    vec2 position_xz = origin + vec2(grid) * spacing;
+
+    out_Position = vec4(position_xz.x, height, position_xz.y, 1.0);
+    out_Normal = vec3(normal_xz.x, sqrt(max(0.0, 1.0 - dot(normal_xz, normal_xz))), normal_xz.y);
+    out_TexCoord = (tex_transform * vec3(position_xz, 1.0)).xy;
+    gl_Position = projection * view * model * out_Position;
+}